@@ -187,6 +187,9 @@ class DualRtspGui(Gtk.Window):
     def _refresh_v4l2_combo(self, select_prefer_loopback: bool = False):
         self.th_dev_combo.remove_all()
         devs = list_v4l2_devices()
+        # The in-process capture element (make gst in v4l2lepton), when it is on GST_PLUGIN_PATH.
+        if has_element("leptonsrc"):
+            devs.insert(0, ("leptonsrc", "Lepton, in-process"))
         if not devs:
             self.th_dev_combo.append_text("/dev/video0 (not found in sysfs)")
             self.th_dev_combo.set_active(0)
@@ -225,11 +228,16 @@ class DualRtspGui(Gtk.Window):
         bitrate_kbps = max(100, bitrate_kbps)
         fr = fps_to_fraction_str(fps_float)
 
+        # leptonsrc stamps frames with their capture time; v4l2src only knows the arrival time
+        if dev == "leptonsrc":
+            src = "leptonsrc type=3 ! video/x-raw,format=I420,width=160,height=120 "
+        else:
+            src = f"v4l2src device={dev} do-timestamp=true ! video/x-raw,format=RGB,width=160,height=120 "
+
         # 不在 v4l2src 上强制 framerate，改用 videorate 降帧
         return (
             f"( "
-            f"v4l2src device={dev} do-timestamp=true "
-            f"! video/x-raw,format=RGB,width=160,height=120 "
+            f"{src}"
             f"! queue leaky=downstream max-size-buffers=2 "
             f"! videoconvert "
             f"! videorate "
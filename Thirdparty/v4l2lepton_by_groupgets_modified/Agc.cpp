@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "Agc.h"
+
+bool agc_mode_parse(const char *s, AgcMode *mode) {
+  if (strcmp(s, "linear") == 0) *mode = AGC_LINEAR;
+  else if (strcmp(s, "clip") == 0) *mode = AGC_CLIP;
+  else if (strcmp(s, "heq") == 0) *mode = AGC_HEQ;
+  else if (strcmp(s, "clahe") == 0) *mode = AGC_CLAHE;
+  else return false;
+  return true;
+}
+
+// Step from `prev` towards `target` by the share of the gap that is not kept.
+uint32_t AgcEngine::damp(uint32_t prev, uint32_t target) const {
+  int64_t d = (int64_t)target - (int64_t)prev;
+  return (uint32_t)((int64_t)prev + d * (int64_t)(256 - cfg.damping) / 256);
+}
+
+// Narrow [*pLo, *pHi] (the frame's range) to the clipLow and (10000 - clipHigh) fractions of
+// its nonzero pixels. The tails are cut from the histogram's ends: the first bin that reaches
+// past the cut on each side becomes the new end. Left alone when the tails would meet (a
+// nearly uniform frame).
+void AgcEngine::percentiles(const uint32_t *hist, int shift, uint16_t *pLo, uint16_t *pHi) {
+  const int lo = agc_bin(*pLo, shift), hi = agc_bin(*pHi, shift);
+  uint64_t total = 0;
+  for (int b = lo; b <= hi; b++) total += hist[b];
+  const uint64_t cutLo = total * cfg.clipLow / 10000;
+  const uint64_t cutHi = total * cfg.clipHigh / 10000;
+
+  int b = lo;
+  uint64_t acc = hist[b];
+  while (acc <= cutLo && b < hi) acc += hist[++b];
+
+  int t = hi;
+  acc = hist[t];
+  while (acc <= cutHi && t > b) acc += hist[--t];
+
+  if (t <= b) return;
+  if (b > lo) *pLo = (uint16_t)(b << shift);
+  if (t < hi) *pHi = (uint16_t)(((t + 1) << shift) - 1);
+}
+
+LinearScale AgcEngine::linear(const uint32_t *hist, int shift, uint16_t minV, uint16_t maxV) {
+  uint16_t lo = minV, hi = maxV;
+  if (cfg.mode == AGC_CLIP && hist) percentiles(hist, shift, &lo, &hi);
+
+  if (!primed) {
+    loQ8 = (uint32_t)lo << 8;
+    hiQ8 = (uint32_t)hi << 8;
+    primed = true;
+  } else {
+    loQ8 = damp(loQ8, (uint32_t)lo << 8);
+    hiQ8 = damp(hiQ8, (uint32_t)hi << 8);
+  }
+  return linear_scale((uint16_t)((loQ8 + 128) >> 8), (uint16_t)((hiQ8 + 128) >> 8));
+}
+
+// Plateau equalisation: bins are capped at the plateau, and each bin maps to the middle of
+// its share of the 0..255 output range, so levels follow the clipped cumulative histogram.
+// Without damping only the frame's own bins are computed; with it the whole table follows,
+// so a range that widens later starts from a settled mapping.
+const uint16_t *AgcEngine::equalize(const uint32_t *hist, int shift, uint16_t minV, uint16_t maxV) {
+  const int lo = agc_bin(minV, shift), hi = agc_bin(maxV, shift);
+  const bool whole = cfg.damping != 0;
+  if (shift != tfShift) primed = false;
+  tfShift = shift;
+
+  uint64_t npix = 0;
+  for (int b = lo; b <= hi; b++) npix += hist[b];
+  uint32_t cap = (uint32_t)(npix * cfg.plateau / 10000);
+  if (cap < 1) cap = 1;
+
+  uint64_t total = 0;
+  for (int b = lo; b <= hi; b++) total += (hist[b] < cap) ? hist[b] : cap;
+  if (total == 0) total = 1;
+
+  uint64_t below = 0;   // clipped count of the bins under b
+  for (int b = whole ? 0 : lo; b <= (whole ? AGC_BINS - 1 : hi); b++) {
+    uint32_t target;
+    if (b < lo) {
+      target = 0;
+    } else if (b > hi) {
+      target = 255 << 8;
+    } else {
+      uint32_t c = (hist[b] < cap) ? hist[b] : cap;
+      target = (uint32_t)((2 * below + c) * (255 << 8) / (2 * total));
+      below += c;
+    }
+    tfQ8[b] = (whole && primed) ? (uint16_t)damp(tfQ8[b], target) : (uint16_t)target;
+  }
+  primed = true;
+  return tfQ8;
+}
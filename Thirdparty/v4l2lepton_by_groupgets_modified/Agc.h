@@ -0,0 +1,75 @@
+#ifndef AGC_H
+#define AGC_H
+
+#include <stdint.h>
+
+#include "RenderKernels.h"
+
+// Host-side AGC: how a frame's 14-bit counts become 8-bit palette indices. Done here rather
+// than by reconfiguring the camera's AGC over CCI, so it costs no I2C round-trips and the
+// output only depends on the frames.
+//
+//   linear  frame min..max stretched to 0..255
+//   clip    linear between two percentiles, so a few hot or cold pixels do not flatten the
+//           rest of the scene; the tails saturate
+//   heq     plateau histogram equalisation: output levels are spread by the histogram, with
+//           every bin capped at the plateau so large uniform areas do not take every level
+//   clahe   local equalisation per tile (Clahe.h), for detail that a global mapping loses
+//
+// The clip and heq modes read the frame's 14-bit histogram (FrameStats::hist). All
+// arithmetic is integer; the transfer function is damped over time in Q8.
+enum AgcMode { AGC_LINEAR = 0, AGC_CLIP = 1, AGC_HEQ = 2, AGC_CLAHE = 3, AGC_COUNT };
+
+// Histogram bins: one per 14-bit count. Radiometric (TLinear) output is in centikelvin and
+// uses up to 16 bits; it is binned by 4 counts (shift 2). Values past the last bin share it.
+#define AGC_BINS 16384
+#define AGC_TLINEAR_SHIFT 2
+
+struct AgcConfig {
+  AgcMode mode;
+  unsigned clipLow, clipHigh;           // clip: pixels cut off each end, in 1/10000 of the frame
+  unsigned plateau;                     // heq: bin cap, in 1/10000 of the frame's pixels
+  unsigned damping;                     // 0..255: share of the previous frame's mapping kept (Q8)
+
+  AgcConfig() : mode(AGC_LINEAR), clipLow(100), clipHigh(100), plateau(300), damping(0) {}
+};
+
+// Parse "linear", "clip", "heq" or "clahe". Returns false for anything else.
+bool agc_mode_parse(const char *s, AgcMode *mode);
+
+class AgcEngine {
+public:
+  AgcEngine() : primed(false), tfShift(0) {}
+
+  void configure(const AgcConfig &c) { cfg = c; primed = false; }
+  const AgcConfig &config() const { return cfg; }
+
+  // Start over without history (e.g. after a capture restart).
+  void reset() { primed = false; }
+
+  // Linear and clip modes: the (damped) input range of this frame. `minV`/`maxV` are the
+  // frame's nonzero range; `hist` (AGC_BINS counts, binned by `shift`) is only read in clip
+  // mode.
+  LinearScale linear(const uint32_t *hist, int shift, uint16_t minV, uint16_t maxV);
+
+  // heq mode: the (damped) transfer function for this frame, AGC_BINS entries of
+  // palette index << 8, indexed by agc_bin(v, shift).
+  const uint16_t *equalize(const uint32_t *hist, int shift, uint16_t minV, uint16_t maxV);
+
+private:
+  void percentiles(const uint32_t *hist, int shift, uint16_t *pLo, uint16_t *pHi);
+  uint32_t damp(uint32_t prev, uint32_t target) const;
+
+  AgcConfig cfg;
+  bool primed;                          // the state below holds a previous frame
+  int tfShift;                          // heq: binning tfQ8 was computed with
+  uint32_t loQ8, hiQ8;                  // linear/clip: damped range, Q8
+  uint16_t tfQ8[AGC_BINS];              // heq: damped transfer function
+};
+
+static inline int agc_bin(uint16_t v, int shift) {
+  v >>= shift;
+  return (v < AGC_BINS) ? v : AGC_BINS - 1;
+}
+
+#endif
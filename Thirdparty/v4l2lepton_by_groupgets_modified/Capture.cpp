@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Capture.h"
+#include "VoSPI.h"
+#include "SPI.h"
+#include "Recording.h"
+
+static double now_sec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ---------------------------------------------------------------------------
+// spidev: the real camera
+
+class SpidevSource : public CaptureSource {
+public:
+  explicit SpidevSource(const CaptureConfig *c)
+    : cfg(*c), batch(c->batch), clockHz((unsigned)c->spi_mhz * 1000000U) {}
+
+  const char *name() const { return "spidev"; }
+
+  bool open() {
+    SpiOpenPort(cfg.spidev);
+    override_speed();
+
+    if (batch > 1) {
+      int maxBatch = SpiMaxBatch(PACKET_SIZE);
+      if (batch > maxBatch) {
+        fprintf(stderr, "SPI batch %d exceeds spidev bufsiz, using %d packets\n", batch, maxBatch);
+        batch = maxBatch;
+      }
+    }
+    return true;
+  }
+
+  void close() { SpiClosePort(); }
+
+  int read(uint8_t *dst, int count) {
+    if (batch <= 1 || count <= 1) {
+      return (::read(spi_cs_fd, dst, PACKET_SIZE) == PACKET_SIZE) ? 1 : 0;
+    }
+    if (count > batch) count = batch;
+    return (SpiReadBatch(dst, PACKET_SIZE, count) == count) ? count : 0;
+  }
+
+  void idle(unsigned usec) { usleep(usec); }
+
+  // spidev deasserts CS at the end of every message, so not clocking is all a resync takes.
+  void resync(unsigned usec) { usleep(usec); }
+
+  // read_block() resyncs right after this, which gives the camera its idle period.
+  void reopen() {
+    SpiClosePort();
+    SpiOpenPort(cfg.spidev);
+    override_speed();
+  }
+
+  bool set_clock(unsigned hz) {
+    unsigned old = clockHz;
+    clockHz = hz;
+    if (!override_speed()) {
+      clockHz = old;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  bool override_speed() {
+    if (clockHz == 0) return true;
+    unsigned int hz = clockHz;
+    if (ioctl(spi_cs_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
+      perror("SPI_IOC_WR_MAX_SPEED_HZ");
+      return false;
+    }
+    spi_speed = hz;
+    if (cfg.verbose) {
+      unsigned int readback = 0;
+      if (ioctl(spi_cs_fd, SPI_IOC_RD_MAX_SPEED_HZ, &readback) == 0) {
+        fprintf(stderr, "SPI speed set/readback: %u Hz\n", readback);
+      }
+    }
+    return true;
+  }
+
+  CaptureConfig cfg;
+  int batch;
+  unsigned clockHz;     // 0 = SPI.cpp default
+};
+
+// ---------------------------------------------------------------------------
+// synth: VoSPI generator
+//
+// Emits the packet stream a Lepton would: ~27 VoSPI frames/s of which only one in
+// (invalid+1) is unique (Lepton 3 marks the repeats with segment number 0), discard packets
+// between segments, optional telemetry rows (footer or header) and random bit errors.
+// The scene is a gradient with a warm blob orbiting over it, in centikelvin-like counts.
+
+#define VOSPI_FRAME_HZ 27.0
+
+class SynthSource : public CaptureSource {
+public:
+  SynthSource(const CaptureConfig *cfg)
+    : type(cfg->typeLepton), realtime(false), telemetry(TELEMETRY_OFF), ber(0.0),
+      invalidFrames(2), discardGap(3), rng(1), desyncEvery(0), cleanHz(0),
+      clockHz((cfg->spi_mhz > 0) ? (unsigned)cfg->spi_mhz * 1000000U : 10000000U), linkBer(0.0) {}
+
+  bool parse(const char *opts) {
+    if (!opts) return true;
+    char *copy = strdup(opts);
+    char *save = NULL;
+    bool ok = true;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+      if (strcmp(tok, "rt") == 0) realtime = true;
+      else if (strcmp(tok, "telemetry") == 0) telemetry = TELEMETRY_FOOTER;
+      else if (strcmp(tok, "telemetry=footer") == 0) telemetry = TELEMETRY_FOOTER;
+      else if (strcmp(tok, "telemetry=header") == 0) telemetry = TELEMETRY_HEADER;
+      else if (strncmp(tok, "seed=", 5) == 0) rng = (uint32_t)strtoul(tok + 5, NULL, 0);
+      else if (strncmp(tok, "ber=", 4) == 0) ber = atof(tok + 4);
+      else if (strncmp(tok, "invalid=", 8) == 0) invalidFrames = atoi(tok + 8);
+      else if (strncmp(tok, "discard=", 8) == 0) discardGap = atoi(tok + 8);
+      else if (strncmp(tok, "desync=", 7) == 0) desyncEvery = atoi(tok + 7);
+      else if (strncmp(tok, "clk=", 4) == 0) cleanHz = (unsigned)(atof(tok + 4) * 1e6);
+      else {
+        fprintf(stderr, "synth: unknown option '%s'\n", tok);
+        ok = false;
+      }
+    }
+    free(copy);
+    if (rng == 0) rng = 1;
+    if (invalidFrames < 0) invalidFrames = 0;
+    if (discardGap < 0) discardGap = 0;
+    if (desyncEvery < 0) desyncEvery = 0;
+    return ok;
+  }
+
+  const char *name() const { return "synth"; }
+
+  bool open() {
+    width = (type == 3) ? 160 : 80;
+    height = (type == 3) ? 120 : 60;
+    segments = (type == 3) ? 4 : 1;
+    imagePackets = PACKETS_PER_FRAME * segments;
+    int telePackets = telemetry ? telemetry_packets(type) : 0;
+    packetsPerSeg = (imagePackets + telePackets) / segments;
+    imageStart = (telemetry == TELEMETRY_HEADER) ? telePackets : 0;
+
+    vframe = 0;
+    seg = 0;
+    pkt = 0;
+    discardLeft = 0;
+    uniqueFrames = 0;
+    lost = false;
+    update_link_ber();
+    t0 = now_sec();
+    render_scene();
+    return true;
+  }
+
+  void close() {}
+
+  int read(uint8_t *dst, int count) {
+    for (int i = 0; i < count; i++) next_packet(dst + PACKET_SIZE * i);
+    return count;
+  }
+
+  void idle(unsigned usec) {
+    if (realtime) usleep(usec);
+  }
+
+  bool can_wait() const { return !realtime; }
+
+  bool set_clock(unsigned hz) {
+    clockHz = hz;
+    update_link_ber();
+    return true;
+  }
+
+  // Like the camera: drop the frame in progress and restart at the next frame boundary
+  // (in real time, the one due now).
+  void resync(unsigned usec) {
+    idle(usec);
+    lost = false;
+    while (pkt != 0 || seg != 0) advance();
+    if (realtime) {
+      while (t0 + (vframe + 1) / VOSPI_FRAME_HZ < now_sec()) {
+        for (int i = 0; i < segments * packetsPerSeg; i++) advance();
+      }
+    }
+  }
+
+private:
+  // Every MHz above the clean clock adds 2e-5 to the bit error rate.
+  void update_link_ber() {
+    linkBer = ber;
+    if (cleanHz && clockHz > cleanHz) linkBer += 2e-5 * (clockHz - cleanHz) / 1e6;
+    bitsToError = next_error_gap();
+  }
+
+  uint32_t rand32() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+  double next_error_gap() {
+    if (linkBer <= 0.0) return HUGE_VAL;
+    double u = (rand32() + 1.0) / 4294967297.0;
+    return -log(u) / linkBer;
+  }
+
+  void render_scene() {
+    double t = uniqueFrames / (VOSPI_FRAME_HZ / (invalidFrames + 1));
+    int cx = width / 2 + (int)(width / 3 * cos(t * 0.7));
+    int cy = height / 2 + (int)(height / 3 * sin(t * 0.9));
+    int r2 = (height / 6) * (height / 6);
+
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        int v = 29500 + 800 * y / height + (int)(rand32() & 15);
+        int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+        if (d2 < r2) v += 2500 * (r2 - d2) / r2;
+        image[y * width + x] = (uint16_t)v;
+      }
+    }
+  }
+
+  bool unique_frame() const { return (vframe % (invalidFrames + 1)) == 0; }
+
+  void put_word(uint8_t *payload, int word, uint16_t v) {
+    payload[2 * word] = (uint8_t)(v >> 8);
+    payload[2 * word + 1] = (uint8_t)v;
+  }
+
+  void put_dword(uint8_t *payload, int word, uint32_t v) {
+    put_word(payload, word, (uint16_t)v);
+    put_word(payload, word + 1, (uint16_t)(v >> 16));
+  }
+
+  void fill_telemetry(uint8_t *payload, int row) {
+    if (row != 0) return;   // only row A carries anything we model
+    uint32_t ms = (uint32_t)((now_sec() - t0) * 1000.0);
+    put_word(payload, TELEMETRY_A_REVISION, 0x000E);
+    put_dword(payload, TELEMETRY_A_TIME_MS, ms);
+    put_dword(payload, TELEMETRY_A_STATUS, 3u << TELEMETRY_STATUS_FFC_STATE_SHIFT);
+    put_dword(payload, TELEMETRY_A_FRAME_COUNTER, uniqueFrames);
+    put_word(payload, TELEMETRY_A_FRAME_MEAN, image[(height / 2) * width + width / 2]);
+    put_word(payload, TELEMETRY_A_FPA_TEMP_COUNTS, 8000);
+    put_word(payload, TELEMETRY_A_FPA_TEMP_K100, 30815);
+    put_word(payload, TELEMETRY_A_FFC_FPA_TEMP_K100, 30790);
+    put_dword(payload, TELEMETRY_A_FFC_TIME_MS, 0);
+  }
+
+  // Out of sync, the host sees the bit stream at an arbitrary offset: noise, as far as
+  // packet IDs are concerned.
+  void make_garbage(uint8_t *p) {
+    for (int i = 0; i < PACKET_SIZE; i += 4) {
+      uint32_t r = rand32();
+      memcpy(p + i, &r, 4);
+    }
+  }
+
+  void make_discard(uint8_t *p) {
+    memset(p, 0, PACKET_SIZE);
+    p[0] = 0x0F;
+    p[1] = (uint8_t)rand32();
+  }
+
+  void make_packet(uint8_t *p) {
+    memset(p, 0, PACKET_SIZE);
+    uint8_t *payload = p + 4;
+    int q = seg * packetsPerSeg + pkt;   // packet index within the VoSPI frame
+    int img = q - imageStart;            // image packet index
+
+    if (type == 3 && pkt == 20) p[0] = (uint8_t)((unique_frame() ? seg + 1 : 0) << 4);
+    p[1] = (uint8_t)pkt;
+
+    if (img >= 0 && img < imagePackets) {
+      const uint16_t *src = (type == 3) ? image + (img / 2) * width + (img & 1) * 80 : image + img * width;
+      for (int i = 0; i < 80; i++) put_word(payload, i, src[i]);
+    } else {
+      fill_telemetry(payload, (img < 0) ? q : img - imagePackets);
+    }
+
+    uint16_t crc = vospi_crc(p);
+    p[2] = (uint8_t)(crc >> 8);
+    p[3] = (uint8_t)crc;
+  }
+
+  void inject_bit_errors(uint8_t *p) {
+    double bits = PACKET_SIZE * 8;
+    while (bitsToError < bits) {
+      int bit = (int)bitsToError;
+      p[bit >> 3] ^= (uint8_t)(0x80 >> (bit & 7));
+      bitsToError += 1.0 + next_error_gap();
+    }
+    bitsToError -= bits;
+  }
+
+  void advance() {
+    if (++pkt < packetsPerSeg) return;
+    pkt = 0;
+    discardLeft = discardGap;
+    if (++seg < segments) return;
+    seg = 0;
+    vframe++;
+    if (unique_frame()) {
+      uniqueFrames++;
+      render_scene();
+      if (desyncEvery && uniqueFrames % desyncEvery == 0) lost = true;
+    }
+  }
+
+  void next_packet(uint8_t *p) {
+    if (lost) {
+      make_garbage(p);
+      return;
+    }
+    if (pkt == 0) {
+      bool early = false;
+      if (realtime) {
+        double due = t0 + (vframe * segments + seg) / (VOSPI_FRAME_HZ * segments);
+        early = now_sec() < due;
+      }
+      if (discardLeft > 0 || early) {
+        if (discardLeft > 0) discardLeft--;
+        make_discard(p);
+        return;
+      }
+    }
+
+    make_packet(p);
+    inject_bit_errors(p);
+    advance();
+  }
+
+  int type;
+  bool realtime;
+  TelemetryMode telemetry;
+  double ber;
+  int invalidFrames;
+  int discardGap;
+  uint32_t rng;
+  int desyncEvery;
+  unsigned cleanHz;         // clk=: 0 = clock does not matter
+  unsigned clockHz;
+  double linkBer;           // ber plus the share caused by an over-fast clock
+
+  int width, height, segments, imagePackets, packetsPerSeg, imageStart;
+  unsigned vframe;          // VoSPI frames emitted (unique or not)
+  uint32_t uniqueFrames;    // frame counter as reported in telemetry
+  int seg, pkt, discardLeft;
+  bool lost;                // desync=: emitting noise until resync()
+  double bitsToError;
+  double t0;
+  uint16_t image[160 * 120];
+};
+
+// ---------------------------------------------------------------------------
+// replay: a --record capture file, or a raw packet dump (a plain concatenation of
+// 164-byte packets). Capture files can be paced by their timestamps (rt).
+
+class ReplaySource : public CaptureSource {
+public:
+  ReplaySource(const CaptureConfig *cfg)
+    : type(cfg->typeLepton), path(NULL), loop(false), realtime(false), isRecording(false),
+      map(NULL), mapsiz(0), npackets(0), pos(0) {}
+  ~ReplaySource() { close(); free(path); }
+
+  bool parse(const char *arg) {
+    if (!arg || !*arg) {
+      fprintf(stderr, "replay: missing file name\n");
+      return false;
+    }
+    path = strdup(arg);
+    char *opt = strchr(path, ',');
+    while (opt) {
+      *opt++ = '\0';
+      char *next = strchr(opt, ',');
+      if (next) *next = '\0';
+      if (strcmp(opt, "loop") == 0) loop = true;
+      else if (strcmp(opt, "rt") == 0) realtime = true;
+      else {
+        fprintf(stderr, "replay: unknown option '%s'\n", opt);
+        return false;
+      }
+      opt = next;
+    }
+    return true;
+  }
+
+  const char *name() const { return "replay"; }
+
+  bool open() {
+    isRecording = RecordingReader::probe(path);
+    return isRecording ? open_recording() : open_raw();
+  }
+
+  void close() {
+    rec.close();
+    if (map) munmap((void *)map, mapsiz);
+    map = NULL;
+  }
+
+  int read(uint8_t *dst, int count) {
+    return isRecording ? read_recording(dst, count) : read_raw(dst, count);
+  }
+
+  bool can_wait() const { return !realtime; }
+
+private:
+  bool open_raw() {
+    if (realtime) fprintf(stderr, "replay: %s has no timestamps, replaying unpaced\n", path);
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "replay: cannot open %s (%s)\n", path, strerror(errno));
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < PACKET_SIZE) {
+      fprintf(stderr, "replay: %s holds no packets\n", path);
+      ::close(fd);
+      return false;
+    }
+    mapsiz = st.st_size;
+    map = (const uint8_t *)mmap(NULL, mapsiz, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      perror("replay: mmap");
+      return false;
+    }
+    madvise((void *)map, mapsiz, MADV_SEQUENTIAL);
+
+    npackets = mapsiz / PACKET_SIZE;
+    if (mapsiz % PACKET_SIZE) {
+      fprintf(stderr, "replay: %s has %zu trailing bytes, ignored\n", path, mapsiz % PACKET_SIZE);
+    }
+    pos = 0;
+    return true;
+  }
+
+  int read_raw(uint8_t *dst, int count) {
+    if (pos == npackets) {
+      if (!loop) return -1;
+      pos = 0;
+    }
+    if ((size_t)count > npackets - pos) count = (int)(npackets - pos);
+    memcpy(dst, map + pos * PACKET_SIZE, (size_t)count * PACKET_SIZE);
+    pos += count;
+    return count;
+  }
+
+  bool open_recording() {
+    if (!rec.open(path)) return false;
+    const RecordingFileHeader *h = rec.header();
+    if ((int)h->lepton_type != type) {
+      fprintf(stderr, "replay: %s was recorded from a Lepton %u, not %d\n", path, h->lepton_type, type);
+      rec.close();
+      return false;
+    }
+    if (rec.frames() == 0) {
+      fprintf(stderr, "replay: %s holds no frames\n", path);
+      rec.close();
+      return false;
+    }
+    packetsPerFrame = h->segments * h->packets_per_segment;
+    pos = 0;
+    restart_clock();
+    return true;
+  }
+
+  void restart_clock() {
+    frameIdx = 0;
+    t0 = now_sec();
+    ts0 = rec.frame(0)->ts_ns[0];
+  }
+
+  // Sleep until segment `seg` of the current frame is due, relative to the first frame.
+  void pace(int seg) {
+    double due = t0 + (rec.frame(frameIdx)->ts_ns[seg] - ts0) * 1e-9;
+    double wait = due - now_sec();
+    if (wait > 0) usleep((useconds_t)(wait * 1e6));
+  }
+
+  int read_recording(uint8_t *dst, int count) {
+    const RecordingFileHeader *h = rec.header();
+    int n = 0;
+
+    while (n < count) {
+      if (pos == packetsPerFrame) {
+        pos = 0;
+        frameIdx++;
+      }
+      if (frameIdx == rec.frames()) {
+        if (!loop) return n ? n : -1;
+        restart_clock();
+      }
+      if (realtime && pos % h->packets_per_segment == 0) {
+        if (n) break;       // hand over what we have before sleeping
+        pace((int)(pos / h->packets_per_segment));
+      }
+      memcpy(dst + PACKET_SIZE * n, rec.packets(frameIdx) + pos * PACKET_SIZE, PACKET_SIZE);
+      pos++;
+      n++;
+    }
+    return n;
+  }
+
+  int type;
+  char *path;
+  bool loop;
+  bool realtime;
+  bool isRecording;
+
+  const uint8_t *map;
+  size_t mapsiz;
+  size_t npackets;
+  size_t pos;
+
+  RecordingReader rec;
+  size_t packetsPerFrame;
+  size_t frameIdx;
+  double t0;
+  uint64_t ts0;
+};
+
+// ---------------------------------------------------------------------------
+
+CaptureSource *capture_create(const char *spec, const CaptureConfig *cfg) {
+  if (!spec || strcmp(spec, "spidev") == 0) {
+    return new SpidevSource(cfg);
+  }
+
+  const char *arg = strchr(spec, ':');
+  size_t kindlen = arg ? (size_t)(arg - spec) : strlen(spec);
+  if (arg) arg++;
+
+  if (kindlen == 5 && strncmp(spec, "synth", 5) == 0) {
+    SynthSource *s = new SynthSource(cfg);
+    if (!s->parse(arg)) { delete s; return NULL; }
+    return s;
+  }
+  if (kindlen == 6 && strncmp(spec, "replay", 6) == 0) {
+    ReplaySource *s = new ReplaySource(cfg);
+    if (!s->parse(arg)) { delete s; return NULL; }
+    return s;
+  }
+
+  fprintf(stderr, "Unknown capture source '%s' (spidev, synth[:opts], replay:<file>)\n", spec);
+  return NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+// Where VoSPI packets come from. read_block() only talks to this interface, so the whole
+// capture -> render -> output pipeline runs the same on a real Lepton, on the synthetic
+// generator and on a replayed packet dump.
+class CaptureSource {
+public:
+  virtual ~CaptureSource() {}
+
+  virtual const char *name() const = 0;
+  virtual bool open() = 0;
+  virtual void close() = 0;
+
+  // Read up to `count` consecutive packets into `dst`. Returns the number of packets read,
+  // 0 on a transient failure, or -1 once the source is exhausted.
+  virtual int read(uint8_t *dst, int count) = 0;
+
+  // Called while the reader is out of sync, to give the camera time to produce a segment.
+  virtual void idle(unsigned usec) { (void)usec; }
+
+  // True if the source loses nothing by being read late (unpaced synth/replay). The capture
+  // thread then waits for a free frame slot instead of dropping frames when render lags.
+  virtual bool can_wait() const { return false; }
+
+  // Sync is lost: stop clocking for `usec` with CS deasserted. A camera then resumes at the
+  // next frame boundary.
+  virtual void resync(unsigned usec) { idle(usec); }
+
+  // Called when resyncing alone does not recover; hardware sources reopen the device here.
+  virtual void reopen() {}
+
+  // Change the link clock (--spi-auto). Returns false if the source has no clock to change.
+  virtual bool set_clock(unsigned hz) { (void)hz; return false; }
+};
+
+struct CaptureConfig {
+  int typeLepton;       // 2 or 3
+  char *spidev;         // spidev node (NULL = SPI.cpp default)
+  int spi_mhz;          // SPI clock override, 0 = keep default
+  int batch;            // packets per SPI ioctl
+  int verbose;
+};
+
+// Build a source from a --source spec:
+//   spidev                       real camera on cfg->spidev (default)
+//   synth[:opt,...]              synthetic VoSPI generator; opts: rt, seed=N, ber=X,
+//                                invalid=N (segment-0 frames per unique frame),
+//                                discard=N (discard packets between segments),
+//                                telemetry[=footer|header],
+//                                clk=MHz (fastest clock the simulated link runs clean at;
+//                                bit errors grow with every MHz above it),
+//                                desync=N (lose sync every N unique frames until resynced)
+//   replay:<file>[,loop][,rt]    --record capture file (rt = paced by its timestamps)
+//                                or a raw 164-byte packet dump
+// Returns NULL (after printing why) on a bad spec.
+CaptureSource *capture_create(const char *spec, const CaptureConfig *cfg);
+
+#endif
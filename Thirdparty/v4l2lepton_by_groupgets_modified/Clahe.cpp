@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Clahe.h"
+
+#define CLAHE_ROWS_PER_BAND 8
+
+static uint64_t clahe_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+ClaheEngine::ClaheEngine()
+  : width(0), height(0), tileW(0), tileH(0), bands(0), src(NULL),
+    lastNs(0), maxNs(0), totalNs(0), frames(0) {
+  memset(&scale, 0, sizeof(scale));
+}
+
+// Tile centres sit at (t + 0.5) * size. A pixel between two centres blends them; one
+// outside the outermost centres takes that tile alone.
+static void blend_axis(int n, int size, int tiles, uint8_t (*tile)[2], uint16_t *w) {
+  for (int i = 0; i < n; i++) {
+    int f = ((2 * i + 1) * 256) / (2 * size) - 128;   // position in tile units, Q8
+    int t0 = (f < 0) ? 0 : f >> 8;
+    if (f < 0 || t0 >= tiles - 1) {
+      t0 = (f < 0) ? 0 : tiles - 1;
+      tile[i][0] = tile[i][1] = (uint8_t)t0;
+      w[i] = 0;
+    } else {
+      tile[i][0] = (uint8_t)t0;
+      tile[i][1] = (uint8_t)(t0 + 1);
+      w[i] = (uint16_t)(f - (t0 << 8));
+    }
+  }
+}
+
+bool ClaheEngine::configure(const ClaheConfig &c, int w, int h) {
+  cfg = c;
+  if (cfg.tilesX <= 0) cfg.tilesX = (w + 19) / 20;
+  if (cfg.tilesY <= 0) cfg.tilesY = (h + 14) / 15;
+  if (w > CLAHE_MAX_WIDTH || h > CLAHE_MAX_HEIGHT ||
+      cfg.tilesX > CLAHE_MAX_TILES || cfg.tilesY > CLAHE_MAX_TILES || w % cfg.tilesX || h % cfg.tilesY) {
+    fprintf(stderr, "clahe: a %dx%d tile grid does not divide a %dx%d frame (at most %d tiles per axis)\n",
+            cfg.tilesX, cfg.tilesY, w, h, CLAHE_MAX_TILES);
+    return false;
+  }
+  if (cfg.clip < 100) cfg.clip = 100;
+
+  width = w;
+  height = h;
+  tileW = w / cfg.tilesX;
+  tileH = h / cfg.tilesY;
+  bands = (h + CLAHE_ROWS_PER_BAND - 1) / CLAHE_ROWS_PER_BAND;
+  blend_axis(width, tileW, cfg.tilesX, colTile, colW);
+  blend_axis(height, tileH, cfg.tilesY, rowTile, rowW);
+
+  if (cfg.threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg.threads = (cpus < 1) ? 1 : (cpus > 4) ? 4 : (int)cpus;
+  }
+  pool.start(cfg.threads);
+  return true;
+}
+
+void ClaheEngine::tile_task(void *self, int t) {
+  ((ClaheEngine *)self)->map_tile(t);
+}
+
+void ClaheEngine::band_task(void *self, int band) {
+  ClaheEngine *e = (ClaheEngine *)self;
+  int y0 = band * CLAHE_ROWS_PER_BAND;
+  int y1 = y0 + CLAHE_ROWS_PER_BAND;
+  e->blend_rows(y0, (y1 < e->height) ? y1 : e->height);
+}
+
+// Level every pixel of tile `t`, histogram the ones with data, clip and redistribute, and
+// turn the cumulative histogram into the tile's mapping.
+void ClaheEngine::map_tile(int t) {
+  const int x0 = (t % cfg.tilesX) * tileW;
+  const int y0 = (t / cfg.tilesX) * tileH;
+  uint32_t hist[256];
+  memset(hist, 0, sizeof(hist));
+  uint32_t n = 0;
+
+  for (int y = y0; y < y0 + tileH; y++) {
+    const uint16_t *p = src + y * width + x0;
+    uint8_t *l = level + y * width + x0;
+    for (int x = 0; x < tileW; x++) {
+      uint8_t v = linear_index(p[x], &scale);
+      l[x] = v;
+      if (p[x]) {
+        hist[v]++;
+        n++;
+      }
+    }
+  }
+
+  uint8_t *map = maps[t];
+  if (n == 0) {
+    for (int i = 0; i < 256; i++) map[i] = (uint8_t)i;
+    return;
+  }
+
+  uint32_t limit = (uint32_t)((uint64_t)n * cfg.clip / (256 * 100));
+  if (limit < 1) limit = 1;
+  uint32_t excess = 0;
+  for (int i = 0; i < 256; i++) {
+    if (hist[i] > limit) {
+      excess += hist[i] - limit;
+      hist[i] = limit;
+    }
+  }
+  const uint32_t each = excess / 256;
+  uint32_t rest = excess % 256;
+  for (int i = 0; i < 256; i++) hist[i] += each;
+  if (rest) {
+    int step = 256 / rest;
+    for (int i = 0; i < 256 && rest; i += step, rest--) hist[i]++;
+  }
+
+  uint32_t cdf = 0;
+  for (int i = 0; i < 256; i++) {
+    cdf += hist[i];
+    map[i] = (uint8_t)(((uint64_t)cdf * 255 + n / 2) / n);
+  }
+}
+
+void ClaheEngine::blend_rows(int y0, int y1) {
+  const int tx = cfg.tilesX;
+  for (int y = y0; y < y1; y++) {
+    const int wy = rowW[y];
+    const uint8_t (*m0)[256] = maps + rowTile[y][0] * tx;   // tile row above the pixel
+    const uint8_t (*m1)[256] = maps + rowTile[y][1] * tx;   // and below
+    const uint16_t *p = src + y * width;
+    const uint8_t *l = level + y * width;
+    uint16_t *o = out + y * width;
+
+    for (int x = 0; x < width; x++) {
+      if (!p[x]) {
+        o[x] = PALETTE_BLACK;
+        continue;
+      }
+      const int v = l[x], wx = colW[x];
+      const int a = colTile[x][0], b = colTile[x][1];
+      const uint32_t top = m0[a][v] * (256 - wx) + m0[b][v] * wx;
+      const uint32_t bot = m1[a][v] * (256 - wx) + m1[b][v] * wx;
+      o[x] = (uint16_t)((top * (256 - wy) + bot * wy + 32768) >> 16);
+    }
+  }
+}
+
+const uint16_t *ClaheEngine::apply(const uint16_t *pix, uint16_t minV, uint16_t maxV) {
+  uint64_t t0 = clahe_now_ns();
+  src = pix;
+  scale = linear_scale(minV, maxV);
+
+  pool.run(cfg.tilesX * cfg.tilesY, tile_task, this);
+  pool.run(bands, band_task, this);
+
+  lastNs = clahe_now_ns() - t0;
+  totalNs += lastNs;
+  frames++;
+  if (lastNs > maxNs) maxNs = lastNs;
+  return out;
+}
@@ -0,0 +1,75 @@
+#ifndef CLAHE_H
+#define CLAHE_H
+
+#include <stdint.h>
+
+#include "RenderKernels.h"
+#include "WorkerPool.h"
+
+// Contrast-limited adaptive histogram equalisation (--agc clahe). The frame is first put on
+// 256 levels by its min..max, then split into a grid of tiles, each equalised by its own
+// histogram with every bin capped at `clip` times the average (the excess is spread over all
+// bins). Every pixel blends the mappings of the four nearest tile centres bilinearly, so
+// there are no seams at tile borders.
+//
+// Tile mappings and the blend run as tasks on a small worker pool: one task per tile, then
+// one per band of rows.
+#define CLAHE_MAX_WIDTH 160
+#define CLAHE_MAX_HEIGHT 120
+#define CLAHE_MAX_TILES 16             // per axis
+
+struct ClaheConfig {
+  int tilesX, tilesY;                  // 0 = tiles of about 20x15 pixels
+  unsigned clip;                       // bin cap, in 1/100 of the average bin
+  int threads;                         // including the render thread; 0 = one per CPU, up to 4
+
+  ClaheConfig() : tilesX(0), tilesY(0), clip(300), threads(0) {}
+};
+
+class ClaheEngine {
+public:
+  ClaheEngine();
+
+  // Size the grid for a width x height frame and start the workers. Returns false (after
+  // printing why) if the grid does not fit the frame.
+  bool configure(const ClaheConfig &c, int width, int height);
+
+  // Palette indices for a frame with nonzero range [minV, maxV]; pixels without data get
+  // PALETTE_BLACK. The result stays valid until the next call.
+  const uint16_t *apply(const uint16_t *pix, uint16_t minV, uint16_t maxV);
+
+  int tiles_x() const { return cfg.tilesX; }
+  int tiles_y() const { return cfg.tilesY; }
+  int threads() const { return pool.size(); }
+
+  // Cost of apply(), wall clock.
+  uint64_t last_ns() const { return lastNs; }
+  uint64_t max_ns() const { return maxNs; }
+  double avg_ns() const { return frames ? (double)totalNs / frames : 0.0; }
+
+private:
+  static void tile_task(void *self, int t);
+  static void band_task(void *self, int band);
+  void map_tile(int t);
+  void blend_rows(int y0, int y1);
+
+  ClaheConfig cfg;
+  int width, height, tileW, tileH, bands;
+  WorkerPool pool;
+
+  // Per frame.
+  const uint16_t *src;
+  LinearScale scale;
+
+  uint8_t level[CLAHE_MAX_WIDTH * CLAHE_MAX_HEIGHT];          // 0..255 by the frame's range
+  uint16_t out[CLAHE_MAX_WIDTH * CLAHE_MAX_HEIGHT];
+  uint8_t maps[CLAHE_MAX_TILES * CLAHE_MAX_TILES][256];       // per tile: level -> index
+
+  // Blend setup per column and row: nearest tile centres and the weight of the second (Q8).
+  uint8_t colTile[CLAHE_MAX_WIDTH][2], rowTile[CLAHE_MAX_HEIGHT][2];
+  uint16_t colW[CLAHE_MAX_WIDTH], rowW[CLAHE_MAX_HEIGHT];
+
+  uint64_t lastNs, maxNs, totalNs, frames;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include "Consumers.h"
+
+// From v4l2loopback.h, which is not installed with the module on most systems.
+#ifndef V4L2_EVENT_PRI_CLIENT_USAGE
+#define V4L2_EVENT_PRI_CLIENT_USAGE (V4L2_EVENT_PRIVATE_START + 0x08E00000 + 1)
+struct v4l2_event_client_usage {
+  __u32 count;
+};
+#endif
+
+ConsumerWatch::ConsumerWatch() : nsinks(0), nwatched(0), watching(false), readers(0), changed(NULL) {
+  stopPipe[0] = stopPipe[1] = -1;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+ConsumerWatch::~ConsumerWatch() {
+  if (watching) {
+    if (write(stopPipe[1], "", 1) < 0) perror("consumers: stop");
+    pthread_join(watcher, NULL);
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+  }
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&lock);
+}
+
+int ConsumerWatch::watch_v4l2(int vfd) {
+  if (nsinks == CONSUMER_MAX_SINKS) return -1;
+  struct v4l2_event_subscription sub;
+  memset(&sub, 0, sizeof(sub));
+  sub.type = V4L2_EVENT_PRI_CLIENT_USAGE;
+  sub.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
+  if (ioctl(vfd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) return -1;
+
+  const int id = nsinks++;
+  sinks[id].fd = vfd;
+  sinks[id].readers = 0;
+  nwatched++;
+
+  // SEND_INITIAL has the driver queue the current count now. Should no event come, assume
+  // a reader rather than never starting; the next attach/detach corrects the count.
+  struct pollfd pfd;
+  pfd.fd = vfd;
+  pfd.events = POLLPRI;
+  if (poll(&pfd, 1, 100) != 1 || !drain_events(id)) update(id, 1);
+  return id;
+}
+
+int ConsumerWatch::add_fixed(int n) {
+  if (nsinks == CONSUMER_MAX_SINKS) return -1;
+  const int id = nsinks++;
+  sinks[id].fd = -1;
+  sinks[id].readers = 0;
+  update(id, n);
+  return id;
+}
+
+bool ConsumerWatch::start() {
+  if (nwatched == 0 || watching) return true;
+  if (pipe(stopPipe) < 0) {
+    perror("consumers: pipe");
+  } else {
+    watching = true;
+    if (pthread_create(&watcher, NULL, watch_main, this) == 0) return true;
+    fprintf(stderr, "consumers: pthread_create failed\n");
+    watching = false;
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+  }
+  for (int i = 0; i < nsinks; i++) {
+    if (sinks[i].fd >= 0) update(i, 1);
+  }
+  return false;
+}
+
+void ConsumerWatch::wait_present() {
+  pthread_mutex_lock(&lock);
+  while (readers.load() <= 0) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+void ConsumerWatch::update(int sink, int n) {
+  pthread_mutex_lock(&lock);
+  int old = readers.load();
+  int total = old + n - sinks[sink].readers.exchange(n);
+  readers = total;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  if (total != old && changed) changed(total);
+}
+
+void *ConsumerWatch::watch_main(void *self) {
+  ((ConsumerWatch *)self)->run();
+  return NULL;
+}
+
+void ConsumerWatch::run() {
+  struct pollfd pfd[CONSUMER_MAX_SINKS + 1];
+  int sinkOf[CONSUMER_MAX_SINKS];
+  int n = 0;
+  for (int i = 0; i < nsinks; i++) {
+    if (sinks[i].fd < 0) continue;
+    pfd[n].fd = sinks[i].fd;
+    pfd[n].events = POLLPRI;
+    sinkOf[n++] = i;
+  }
+  pfd[n].fd = stopPipe[0];
+  pfd[n].events = POLLIN;
+
+  for (;;) {
+    if (poll(pfd, n + 1, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("consumers: poll");
+      break;
+    }
+    if (pfd[n].revents) break;
+    for (int i = 0; i < n; i++) {
+      if (pfd[i].revents & POLLPRI) drain_events(sinkOf[i]);
+    }
+  }
+}
+
+// Called once POLLPRI reports a queued event. The sink fd is blocking, so VIDIOC_DQEVENT
+// on an empty queue would wait for the next event: stop after the last one (`pending` 0)
+// instead, or on any error (EAGAIN). Returns whether a client count was seen.
+bool ConsumerWatch::drain_events(int sink) {
+  bool seen = false;
+  for (;;) {
+    struct v4l2_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (ioctl(sinks[sink].fd, VIDIOC_DQEVENT, &ev) < 0) break;
+    if (ev.type == V4L2_EVENT_PRI_CLIENT_USAGE) {
+      struct v4l2_event_client_usage usage;
+      memcpy(&usage, ev.u.data, sizeof(usage));
+      update(sink, (int)usage.count);
+      seen = true;
+    }
+    if (ev.pending == 0) break;
+  }
+  return seen;
+}
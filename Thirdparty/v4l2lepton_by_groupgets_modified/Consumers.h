@@ -0,0 +1,63 @@
+#ifndef CONSUMERS_H
+#define CONSUMERS_H
+
+#include <pthread.h>
+#include <atomic>
+
+// Who is reading the output. Capture only runs while the count is above zero, so the SPI
+// link and the CPU stay idle while nobody watches and streaming starts as soon as a client
+// attaches.
+//
+// v4l2loopback (0.12.5 and later) reports the number of capture clients through a private
+// V4L2 event; a watcher thread waits for it with poll() on every output device and updates
+// the counts. Sinks that cannot report readers (plain files, older drivers) are given a
+// fixed count instead. count() is the total over all sinks.
+#define CONSUMER_MAX_SINKS 8
+
+class ConsumerWatch {
+public:
+  ConsumerWatch();
+  ~ConsumerWatch();
+
+  // Follow the client count of a v4l2loopback output device. Returns the sink's id, or -1
+  // if the driver does not report it. Every sink is added before start().
+  int watch_v4l2(int fd);
+
+  // A sink whose count never changes (1 = always watched). Returns its id.
+  int add_fixed(int n);
+
+  // Start watching the v4l2 sinks, if there are any. Returns false if that fails; they then
+  // count as always watched, like sinks that do not report readers.
+  bool start();
+
+  int count() const { return readers.load(); }
+  int count(int sink) const { return sinks[sink].readers.load(); }
+
+  // Block until count() > 0.
+  void wait_present();
+
+  // Called on the watcher thread after every change of the total count.
+  void on_change(void (*cb)(int count)) { changed = cb; }
+
+private:
+  static void *watch_main(void *self);
+  void run();
+  bool drain_events(int sink);
+  void update(int sink, int n);
+
+  struct Sink {
+    int fd;                          // -1 = fixed count
+    std::atomic<int> readers;
+  };
+  Sink sinks[CONSUMER_MAX_SINKS];
+  int nsinks, nwatched;
+  int stopPipe[2];
+  bool watching;
+  pthread_t watcher;
+  std::atomic<int> readers;          // over all sinks
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  void (*changed)(int count);
+};
+
+#endif
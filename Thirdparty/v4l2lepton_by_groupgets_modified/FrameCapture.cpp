@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+
+#include "FrameCapture.h"
+
+// Resynchronisation (capture thread only). A sequence break is first chased by reading on to
+// the next segment start; only when that fails does read_block() fall back to the VoSPI
+// resync (CS deasserted for VOSPI_RESYNC_IDLE_US), and to reopening the device if even that
+// keeps failing. Time to resync runs from the first out-of-sequence packet to the next
+// complete segment.
+#define RESYNC_HUNT_SEGMENTS 2   // out-of-sequence packets tolerated, in segments, before a resync
+#define RESYNC_REOPEN_AFTER 4    // back-to-back resyncs without a segment before reopening
+#define DISCARD_POLL_USEC 1000   // back-off while the camera sends discard packets
+
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+FrameCapture::FrameCapture()
+  : source(NULL), packetsPerSeg(PACKETS_PER_FRAME), histShift(0), spiAuto(false),
+    crcErrors(0), syncLosses(0), badSegments(0), stash_valid(false),
+    capture_running(false), capture_eos(false) {
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&segLayout, 0, sizeof(segLayout));
+  memset(&resyncStats, 0, sizeof(resyncStats));
+  sem_init(&frameready, 0, 0);
+}
+
+FrameCapture::~FrameCapture() {
+  if (capture_running) stop();
+  sem_destroy(&frameready);
+}
+
+void FrameCapture::configure(CaptureSource *src, const FrameCaptureConfig &c) {
+  source = src;
+  cfg = c;
+  spiAuto = c.spiAuto;
+  histShift = 0;
+
+  packetsPerSeg = PACKETS_PER_FRAME;
+  if (cfg.telemetry != TELEMETRY_OFF) {
+    packetsPerSeg = (cfg.typeLepton == 3) ? PACKETS_PER_FRAME + 1 : PACKETS_PER_FRAME + TELEMETRY_PACKETS_L2;
+  }
+  segLayout.packetsPerSeg = packetsPerSeg;
+  segLayout.imageStart = (cfg.telemetry == TELEMETRY_HEADER) ? telemetry_packets(cfg.typeLepton) : 0;
+  segLayout.rowA = (cfg.telemetry == TELEMETRY_OFF) ? -1
+                 : (cfg.telemetry == TELEMETRY_HEADER) ? 0 : PACKETS_PER_FRAME * ((cfg.typeLepton == 3) ? 4 : 1);
+}
+
+void FrameCapture::tune_spi_clock() {
+  if (!spiAuto) return;
+  unsigned hz = spiTuner.update(monotonic_ns(), crcErrors + syncLosses + badSegments);
+  if (hz && !source->set_clock(hz)) spiTuner.reject(hz);
+}
+
+bool FrameCapture::start() {
+  if (!source->open()) return false;
+
+  if (spiAuto) {
+    unsigned hz = spiTuner.begin(cfg.spiTune, cfg.spiHz, monotonic_ns());
+    if (!source->set_clock(hz)) {
+      fprintf(stderr, "%s source has no SPI clock, --spi-auto ignored\n", source->name());
+      spiAuto = false;
+    }
+  }
+
+  // The consumer is not taking frames here, so the ring can be reset safely.
+  stash_valid = false;
+  framering.reset();
+  while (sem_trywait(&frameready) == 0) {}
+
+  capture_running = true;
+  capture_eos = false;
+  if (pthread_create(&capturer, NULL, capture_main, this)) {
+    fprintf(stderr, "pthread_create capture failed\n");
+    capture_running = false;
+    source->close();
+    return false;
+  }
+  return true;
+}
+
+void FrameCapture::stop() {
+  capture_running = false;
+  pthread_join(capturer, NULL);
+  source->close();
+}
+
+Frame *FrameCapture::next() {
+  while (sem_wait(&frameready) == -1 && errno == EINTR) {}
+  return framering.front();
+}
+
+void FrameCapture::release() {
+  framering.release();
+}
+
+void FrameCapture::wake() {
+  sem_post(&frameready);
+}
+
+// After a bad packet at slot `j`, look through the `avail` already-received slots
+// starting there for the start of a fresh segment (non-discard packet 0).
+// Returns its offset from `j`, or -1 if the batch holds nothing worth keeping.
+int FrameCapture::find_segment_start(const uint8_t *dst, int j, int avail) const {
+  for (int k = 0; k < avail; k++) {
+    const uint8_t *q = dst + PACKET_SIZE * (j + k);
+    if (!is_discard_packet(q) && q[1] == 0) return k;
+  }
+  return -1;
+}
+
+// Read one segment (`packetsPerSeg` packets) into `dst` (SEGMENT_SLOT_SIZE bytes), keeping alignment.
+// Returns false once the capture source is exhausted.
+// Key behaviors:
+// - Lepton3 segment number is extracted at packetNumber==20 (same as reference LeptonThread.cpp logic).
+// - Without --telemetry, after 60 packets peek 1 packet to handle a camera that sends telemetry
+//   anyway (61st packet) vs next segment packet0 (stash).
+// - Every packet's CRC is checked; a corrupt packet is counted and handled like a sequence break.
+// - Discard packets are polled with a short back-off. Out-of-sequence packets are read through
+//   without sleeping, since the next segment start usually follows within one segment; if it
+//   does not, sync is lost and the source is resynced (see RESYNC_*).
+// - With --batch, packets arrive in chunks straight into their `dst` slots and are validated
+//   in place; on a sequence break the rest of the chunk is searched for a new packet 0 and
+//   shifted down instead of being thrown away.
+bool FrameCapture::read_block(uint8_t *dst, int *out_segmentNumber, int *out_resets) {
+  int resets = 0;
+  int segmentNumber = -1;
+  int avail = 0;   // received but not yet validated slots starting at j
+  const bool peekNext = (cfg.typeLepton == 3) && (cfg.telemetry == TELEMETRY_OFF);
+  const int slots = packetsPerSeg + (peekNext ? 1 : 0);
+  int outOfSeq = 0;          // out-of-sequence packets since the last resync
+  int resyncs = 0;           // resyncs during this outage
+  uint64_t outageStart = 0;  // first out-of-sequence packet, 0 = in sync
+
+  for (int j = 0; j < packetsPerSeg; ) {
+    uint8_t *pkt = dst + PACKET_SIZE * j;
+
+    if (avail == 0) {
+      if (j == 0 && stash_valid) {
+        memcpy(pkt, stash_pkt, PACKET_SIZE);
+        stash_valid = false;
+        avail = 1;
+      } else {
+        avail = source->read(pkt, slots - j);
+        if (avail < 0) return false;
+        if (avail == 0) {
+          j = 0;
+          resets++;
+          source->idle(DISCARD_POLL_USEC);
+          continue;
+        }
+      }
+    }
+
+    int packetNumber = pkt[1];
+    bool bad = is_discard_packet(pkt) || packetNumber != j;
+    bool crcBad = false;
+    if (!bad && cfg.checkCrc && !vospi_crc_ok(pkt)) {
+      bad = crcBad = true;
+      crcErrors++;
+      if (cfg.verbose && (crcErrors % 100 == 1)) {
+        fprintf(stderr, "[INFO] CRC errors: %lu (packet %d)\n", crcErrors, packetNumber);
+      }
+    }
+    if (bad) {
+      resets++;
+      if (j > 0 && !crcBad) syncLosses++;
+      tune_spi_clock();
+
+      int k = find_segment_start(dst, j, avail);
+      if (k >= 0 && (j + k) != 0) {
+        avail -= k;
+        memmove(dst, dst + PACKET_SIZE * (j + k), PACKET_SIZE * avail);
+        j = 0;
+        segmentNumber = -1;
+        continue;
+      }
+
+      j = 0;
+      avail = 0;
+      segmentNumber = -1;
+
+      if (is_discard_packet(pkt) && !crcBad) {
+        source->idle(DISCARD_POLL_USEC);
+        continue;
+      }
+
+      if (!outageStart) outageStart = monotonic_ns();
+      if (++outOfSeq < RESYNC_HUNT_SEGMENTS * packetsPerSeg) continue;
+
+      // Lost sync: with CS deasserted long enough the camera restarts at a frame boundary.
+      outOfSeq = 0;
+      stash_valid = false;
+      if (++resyncs % RESYNC_REOPEN_AFTER == 0) {
+        resyncStats.reopens++;
+        if (cfg.verbose) fprintf(stderr, "[INFO] resync failed %d times, reopening %s\n", resyncs, source->name());
+        source->reopen();
+      }
+      source->resync(VOSPI_RESYNC_IDLE_US);
+      continue;
+    }
+
+    if ((cfg.typeLepton == 3) && (packetNumber == 20)) {
+      int seg = packet_segment_number(pkt);
+      // seg can be 0 for invalid segments; accept it and let upper layer drop
+      segmentNumber = seg;
+    }
+
+    j++;
+    avail--;
+  }
+
+  // Peek 1 packet to keep alignment with telemetry on/off.
+  if (peekNext) {
+    uint8_t *peek = dst + PACKET_SIZE * PACKETS_PER_FRAME;
+    bool got = (avail > 0) || (source->read(peek, 1) == 1);
+    if (got && !is_discard_packet(peek)) {
+      int pn = peek[1];
+      if (pn != 60) {
+        memcpy(stash_pkt, peek, PACKET_SIZE);
+        stash_valid = true;
+      }
+      // pn==60 => telemetry packet; discard it
+    }
+  }
+
+  if (resyncs) {
+    uint64_t took = monotonic_ns() - outageStart;
+    resyncStats.count++;
+    resyncStats.last_ns = took;
+    resyncStats.total_ns += took;
+    if (took > resyncStats.max_ns) resyncStats.max_ns = took;
+    if (cfg.verbose) fprintf(stderr, "[INFO] resync #%lu: in sync after %.1f ms\n", resyncStats.count, took * 1e-6);
+  }
+
+  if (cfg.verbose && resets >= 30) {
+    fprintf(stderr, "done reading, resets=%d\n", resets);
+  }
+
+  if (cfg.typeLepton == 3) {
+    if (segmentNumber == -1) segmentNumber = 0;
+    *out_segmentNumber = segmentNumber;
+  } else {
+    *out_segmentNumber = 1;
+  }
+
+  *out_resets = resets;
+  return true;
+}
+
+// Decode one segment's payload (big-endian, 2 ID/CRC words per packet) into the frame plane
+// and parse telemetry row A into f->tele; see Render.cpp.
+void FrameCapture::decode_segment(Frame *f, int segno) {
+  cfg.path->decode(f->pix, f->seg[segno - 1], segno, &segLayout, cfg.kernels, &f->stats, &f->tele);
+}
+
+void FrameCapture::setup_thread() {
+  if (cfg.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cfg.cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) fprintf(stderr, "capture: cannot pin to CPU %d (%s)\n", cfg.cpu, strerror(err));
+  }
+
+  if (cfg.rtPrio > 0) {
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = cfg.rtPrio;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (err) fprintf(stderr, "capture: cannot set SCHED_FIFO %d (%s)\n", cfg.rtPrio, strerror(err));
+  }
+}
+
+// Frame slot the capture thread assembles into: the ring's next free slot, or `scratch`
+// when the renderer is behind (that frame is then dropped instead of stalling capture).
+// Sources that cannot fall behind (unpaced synth/replay) wait for a slot instead.
+Frame *FrameCapture::claim_frame(unsigned *dropped) {
+  Frame *f = framering.claim();
+  while (!f && source->can_wait() && capture_running.load(std::memory_order_relaxed)) {
+    usleep(200);
+    f = framering.claim();
+  }
+  if (!f) {
+    (*dropped)++;
+    if (cfg.verbose && (*dropped % 100 == 1)) {
+      fprintf(stderr, "[INFO] frame ring full, dropped: %u\n", *dropped);
+    }
+    f = &scratch;
+  }
+  f->got = 0;
+  f->tele.valid = false;
+  frame_stats_reset(&f->stats, cfg.keepHist ? f->hist : NULL, histShift);
+  return f;
+}
+
+void *FrameCapture::capture_main(void *self) {
+  ((FrameCapture *)self)->run();
+  return NULL;
+}
+
+// Capture thread: read segments straight into the frame slot they belong to and publish
+// complete frames to `framering`. Never waits on the consumer.
+void FrameCapture::run() {
+  unsigned invalidSegs = 0;
+  unsigned dropped = 0;
+  const unsigned allSegs = (cfg.typeLepton == 3) ? 0xF : 0x1;
+  int expect = 1;   // segment we expect next; packets are read into its slot
+  uint64_t seq = 0;
+  bool haveCounter = false;
+  uint32_t lastCounter = 0;
+  unsigned long duplicates = 0;
+
+  setup_thread();
+
+  Frame *f = claim_frame(&dropped);
+
+  while (capture_running.load(std::memory_order_relaxed)) {
+    int segno = 0, resets = 0;
+    if (!read_block(f->seg[expect - 1], &segno, &resets)) {
+      capture_eos = true;
+      sem_post(&frameready);   // wake the renderer so it sees the end of stream
+      break;
+    }
+
+    tune_spi_clock();
+
+    // segno==0 => invalid segment; drop quietly (it happens)
+    if (segno < 1 || segno > 4) {
+      if (segno > 4) badSegments++;
+      invalidSegs++;
+      if (cfg.verbose && (invalidSegs % 200 == 0)) {
+        fprintf(stderr, "[INFO] invalid segments seen: %u (segno=%d)\n", invalidSegs, segno);
+      }
+      continue;
+    }
+
+    if (segno == 1 && f->got) {
+      f->got = 0;
+      frame_stats_reset(&f->stats, cfg.keepHist ? f->hist : NULL, histShift);
+    }
+    if (segno != expect) {
+      // Out-of-order segment (resync): move it to where it belongs.
+      memcpy(f->seg[segno - 1], f->seg[expect - 1], PACKET_SIZE * packetsPerSeg);
+    }
+    f->seg_ts_ns[segno - 1] = monotonic_ns();
+    decode_segment(f, segno);
+    f->got |= 1u << (segno - 1);
+    expect = (cfg.typeLepton == 3) ? (segno % 4) + 1 : 1;
+
+    if (segno == ((cfg.typeLepton == 3) ? 4 : 1)) {
+      invalidSegs = 0;
+      if (f->got == allSegs) {
+        f->seq = seq++;
+        uint16_t lo, hi;
+        if (cfg.keepHist && histShift == 0 && frame_stats_range(&f->stats, (cfg.typeLepton == 3) ? 4 : 1, &lo, &hi) &&
+            hi >= AGC_BINS) {
+          // Radiometric output: bin the following frames by 4 counts.
+          histShift = AGC_TLINEAR_SHIFT;
+          if (cfg.verbose) fprintf(stderr, "[INFO] pixel values above 14 bits (TLinear), histogram bins of %d\n", 1 << histShift);
+        }
+        if (cfg.recorder) {
+          const uint8_t *segs[4] = { f->seg[0], f->seg[1], f->seg[2], f->seg[3] };
+          cfg.recorder->submit(f->seq, f->seg_ts_ns, segs);
+        }
+        // VoSPI repeats each unique frame ~3x; with telemetry the frame counter tells them
+        // apart exactly, so repeats never reach render/output.
+        bool duplicate = f->tele.valid && haveCounter && f->tele.frame_counter == lastCounter;
+        if (f->tele.valid) {
+          haveCounter = true;
+          lastCounter = f->tele.frame_counter;
+        }
+        if (duplicate) {
+          duplicates++;
+          if (cfg.verbose && (duplicates % 100 == 0)) {
+            fprintf(stderr, "[INFO] duplicate frames skipped: %lu\n", duplicates);
+          }
+        } else if (f != &scratch) {
+          framering.publish();
+          sem_post(&frameready);
+        }
+      }
+      f = claim_frame(&dropped);
+    }
+  }
+}
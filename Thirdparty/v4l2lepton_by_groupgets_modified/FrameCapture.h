@@ -0,0 +1,128 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+
+#include "VoSPI.h"
+#include "Capture.h"
+#include "Recording.h"
+#include "SpiTune.h"
+#include "SpscRing.h"
+#include "Render.h"
+
+// Room for the largest segment (Lepton 2 with telemetry: 63 packets), or 60 packets plus
+// the Lepton 3 peek packet that a batched read pulls in with the segment.
+#define SEGMENT_SLOT_PACKETS 64
+#define SEGMENT_SLOT_SIZE (PACKET_SIZE * SEGMENT_SLOT_PACKETS)
+#define MAX_WIDTH 160
+#define MAX_HEIGHT 120
+
+// A frame slot is filled in place by the capture thread: packets are read straight into
+// the slot of the segment they belong to, and each finished segment is decoded once into
+// `pix` (host-order, row-major, `width` pixels per row). Lepton 2 uses seg[0] only.
+struct Frame {
+  uint8_t seg[4][SEGMENT_SLOT_SIZE];
+  uint16_t pix[MAX_WIDTH * MAX_HEIGHT];
+  unsigned got;                 // bitmask of segments present
+  uint64_t seq;                 // capture sequence number of complete frames
+  uint64_t seg_ts_ns[4];        // CLOCK_MONOTONIC when each segment was read
+  Telemetry tele;               // row A, when --telemetry is on
+  FrameStats stats;             // min/max (and histogram) of the segments decoded so far
+  uint32_t hist[AGC_BINS];
+};
+
+struct FrameCaptureConfig {
+  int typeLepton;               // 2 or 3
+  TelemetryMode telemetry;
+  bool checkCrc;                // validate every packet's CRC16
+  bool keepHist;                // gather FrameStats::hist while decoding (AGC clip, heq)
+  const RenderPath *path;       // decodes the segments
+  const RenderKernels *kernels;
+  int rtPrio;                   // SCHED_FIFO priority for the capture thread (0 = normal)
+  int cpu;                      // CPU to pin the capture thread to (-1 = any)
+  bool spiAuto;                 // pick the SPI clock from the live error rate
+  const SpiTuneConfig *spiTune;
+  unsigned spiHz;               // clock to start from, 0 = the source's
+  RecordingWriter *recorder;    // raw frames go here too; NULL = not recording
+  int verbose;
+};
+
+struct ResyncStats {
+  unsigned long count;          // outages that needed a VoSPI resync
+  unsigned long reopens;
+  uint64_t last_ns, max_ns, total_ns;
+};
+
+// The capture thread: drains the source (SPI) only, assembles segments into frames and
+// hands complete frames to one consumer thread through a ring with 4 frames of slack. It
+// never waits on the consumer; a frame that finds the ring full is dropped.
+class FrameCapture {
+public:
+  FrameCapture();
+  ~FrameCapture();
+
+  // Before start(). `src` stays the caller's.
+  void configure(CaptureSource *src, const FrameCaptureConfig &cfg);
+  int packets_per_segment() const { return packetsPerSeg; }   // 61 (L3) / 63 (L2) with telemetry rows
+  int segments() const { return (cfg.typeLepton == 3) ? 4 : 1; }
+  const SegmentLayout *layout() const { return &segLayout; }
+
+  // Open the source and start the capture thread. Returns false if the source cannot be
+  // opened.
+  bool start();
+  // Stop the thread and close the source. Frames not taken yet are discarded.
+  void stop();
+
+  // Consumer side. Block until the next complete frame, and hand it back with release().
+  // Returns NULL at the end of a finite source once every frame has been taken, or when
+  // wake() found nothing pending.
+  Frame *next();
+  void release();
+  // Get a consumer blocked in next() out (from any thread).
+  void wake();
+  // The source is exhausted (replay without loop).
+  bool eos() const { return capture_eos.load(); }
+
+  // Link errors. Discard packets and segment-0 repeats are normal VoSPI traffic and are
+  // not counted.
+  unsigned long crc_errors() const { return crcErrors; }      // packets failing the CRC check
+  unsigned long sync_losses() const { return syncLosses; }    // segments that broke off after packet 0
+  unsigned long bad_segments() const { return badSegments; }  // Lepton 3 segment numbers outside 0..4
+  const ResyncStats &resyncs() const { return resyncStats; }
+
+private:
+  static void *capture_main(void *self);
+  void run();
+  void setup_thread();
+  void tune_spi_clock();
+  int find_segment_start(const uint8_t *dst, int j, int avail) const;
+  bool read_block(uint8_t *dst, int *out_segmentNumber, int *out_resets);
+  void decode_segment(Frame *f, int segno);
+  Frame *claim_frame(unsigned *dropped);
+
+  FrameCaptureConfig cfg;
+  CaptureSource *source;
+  int packetsPerSeg;
+  SegmentLayout segLayout;
+  int histShift;                // AGC_TLINEAR_SHIFT once a frame exceeds 14 bits
+  bool spiAuto;
+  SpiClockTuner spiTuner;
+
+  // Capture thread only.
+  unsigned long crcErrors, syncLosses, badSegments;
+  ResyncStats resyncStats;
+  bool stash_valid;             // telemetry alignment: next segment's packet 0, if peeked
+  uint8_t stash_pkt[PACKET_SIZE];
+
+  SpscRing<Frame, 4> framering;
+  Frame scratch;                // assembly target while the ring is full (frame gets dropped)
+  sem_t frameready;
+  pthread_t capturer;
+  std::atomic<bool> capture_running;
+  std::atomic<bool> capture_eos;
+};
+
+#endif
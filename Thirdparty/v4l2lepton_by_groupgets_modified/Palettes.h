@@ -1,8 +1,25 @@
 #ifndef PALETTES_H
 #define PALETTES_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 extern const int colormap_rainbow[];
 extern const int colormap_grayscale[];
 extern const int colormap_ironblack[];
 
+// The palettes above packed at compile time as one R | G << 8 | B << 16 word per level,
+// plus a black entry for pixels without data.
+#define PALETTE_LEVELS 256
+#define PALETTE_BLACK 256
+#define PALETTE_RGBX_SIZE 257
+
+// 1 rainbow, 2 grayscale, 3 ironblack.
+const uint32_t *palette_rgbx(int colormap);
+
+// The same palettes in BT.601 YUV, packed Y | U << 8 | V << 16 like the RGB ones. Limited
+// range (Y 16..235) for the YUV output formats; full range for GREY, where the grayscale
+// palette's Y equals its level.
+const uint32_t *palette_yuvx(int colormap, bool fullRange);
+
 #endif
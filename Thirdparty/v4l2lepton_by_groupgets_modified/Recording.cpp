@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Recording.h"
+
+static uint64_t clock_ns(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  const uint8_t *p = (const uint8_t *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+
+RecordingWriter::RecordingWriter()
+  : fd(-1), segments(0), packetsPerSegment(0), recordSize(0),
+    running(false), nwritten(0), ndropped(0) {}
+
+RecordingWriter::~RecordingWriter() { close(); }
+
+bool RecordingWriter::open(const char *path, int leptonType, int segs, int packetsPerSeg) {
+  if (segs < 1 || segs > RECORDING_MAX_SEGMENTS ||
+      packetsPerSeg < 1 || packetsPerSeg > RECORDING_MAX_PACKETS_PER_SEGMENT) {
+    fprintf(stderr, "record: unsupported layout %d x %d packets\n", segs, packetsPerSeg);
+    return false;
+  }
+
+  fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "record: cannot create %s (%s)\n", path, strerror(errno));
+    return false;
+  }
+
+  segments = segs;
+  packetsPerSegment = packetsPerSeg;
+  recordSize = recording_record_size(segs, packetsPerSeg);
+
+  RecordingFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, RECORDING_MAGIC, sizeof(h.magic));
+  h.version = RECORDING_VERSION;
+  h.header_size = sizeof(h);
+  h.lepton_type = leptonType;
+  h.segments = segs;
+  h.packets_per_segment = packetsPerSeg;
+  h.packet_size = PACKET_SIZE;
+  h.record_size = recordSize;
+  h.start_realtime_ns = clock_ns(CLOCK_REALTIME);
+  h.start_monotonic_ns = clock_ns(CLOCK_MONOTONIC);
+
+  if (!write_all(fd, &h, sizeof(h))) {
+    perror("record: write header");
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  queue.reset();
+  if (sem_init(&pending, 0, 0) == -1) {
+    perror("record: sem_init");
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  running = true;
+  if (pthread_create(&writer, NULL, writer_main, this)) {
+    fprintf(stderr, "record: pthread_create failed\n");
+    running = false;
+    sem_destroy(&pending);
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void RecordingWriter::close() {
+  if (fd < 0) return;
+
+  running = false;
+  sem_post(&pending);
+  pthread_join(writer, NULL);
+  sem_destroy(&pending);
+
+  fdatasync(fd);
+  ::close(fd);
+  fd = -1;
+}
+
+bool RecordingWriter::submit(uint64_t seq, const uint64_t *ts_ns, const uint8_t *const *segs) {
+  Slot *s = queue.claim();
+  if (!s) {
+    ndropped++;
+    return false;
+  }
+
+  memset(&s->hdr, 0, sizeof(s->hdr));
+  s->hdr.seq = seq;
+  s->hdr.segments = segments;
+  const size_t segBytes = (size_t)packetsPerSegment * PACKET_SIZE;
+  for (int i = 0; i < segments; i++) {
+    s->hdr.ts_ns[i] = ts_ns[i];
+    memcpy(s->packets + i * segBytes, segs[i], segBytes);
+  }
+
+  queue.publish();
+  sem_post(&pending);
+  return true;
+}
+
+void *RecordingWriter::writer_main(void *self) {
+  ((RecordingWriter *)self)->run();
+  return NULL;
+}
+
+void RecordingWriter::run() {
+  const size_t payload = sizeof(RecordingFrameHeader) + (size_t)segments * packetsPerSegment * PACKET_SIZE;
+  static const uint8_t zeros[8] = {0};
+
+  for (;;) {
+    while (sem_wait(&pending) == -1 && errno == EINTR) {}
+
+    Slot *s = queue.front();
+    if (!s) {
+      if (!running) break;
+      continue;
+    }
+
+    // Slot is laid out exactly like the on-disk record up to `payload`.
+    if (!write_all(fd, s, payload) || !write_all(fd, zeros, recordSize - payload)) {
+      perror("record: write");
+      queue.release();
+      break;
+    }
+    queue.release();
+    nwritten++;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+RecordingReader::RecordingReader() : map(NULL), mapsiz(0), hdr(NULL), nframes(0) {}
+
+RecordingReader::~RecordingReader() { close(); }
+
+bool RecordingReader::probe(const char *path) {
+  char magic[8];
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic)) &&
+            memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0;
+  ::close(fd);
+  return ok;
+}
+
+bool RecordingReader::open(const char *path) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "recording: cannot open %s (%s)\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(RecordingFileHeader)) {
+    fprintf(stderr, "recording: %s is too short\n", path);
+    ::close(fd);
+    return false;
+  }
+
+  mapsiz = st.st_size;
+  map = (const uint8_t *)mmap(NULL, mapsiz, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    perror("recording: mmap");
+    return false;
+  }
+
+  hdr = (const RecordingFileHeader *)map;
+  if (memcmp(hdr->magic, RECORDING_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != RECORDING_VERSION || hdr->packet_size != PACKET_SIZE ||
+      hdr->header_size < sizeof(RecordingFileHeader) || hdr->header_size > mapsiz ||
+      hdr->segments < 1 || hdr->segments > RECORDING_MAX_SEGMENTS ||
+      hdr->record_size != recording_record_size(hdr->segments, hdr->packets_per_segment)) {
+    fprintf(stderr, "recording: %s is not a supported capture file\n", path);
+    close();
+    return false;
+  }
+
+  // A trailing partial record (writer interrupted) is ignored.
+  nframes = (mapsiz - hdr->header_size) / hdr->record_size;
+  return true;
+}
+
+void RecordingReader::close() {
+  if (map) munmap((void *)map, mapsiz);
+  map = NULL;
+  hdr = NULL;
+  nframes = 0;
+}
+
+const RecordingFrameHeader *RecordingReader::frame(size_t i) const {
+  return (const RecordingFrameHeader *)(map + hdr->header_size + i * (size_t)hdr->record_size);
+}
@@ -0,0 +1,125 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+
+#include "VoSPI.h"
+#include "SpscRing.h"
+
+// Raw VoSPI capture file (--record).
+//
+//   RecordingFileHeader                      64 bytes
+//   record 0, record 1, ...                  header.record_size bytes each
+//
+// Every record is one complete frame as it came off the wire:
+//
+//   RecordingFrameHeader                     48 bytes
+//   segments * packets_per_segment packets   164 bytes each, segment-major, validated
+//   zero padding                             up to a multiple of 8
+//
+// Records are fixed size, so frame i lives at header_size + i * record_size: that is the
+// index, and seeking is O(1). The file is append-only and the frame count is derived from
+// the file size, so a capture cut short by a crash or power loss stays readable.
+
+#define RECORDING_MAGIC "LEPVOSPI"
+#define RECORDING_VERSION 1
+#define RECORDING_MAX_SEGMENTS 4
+#define RECORDING_MAX_PACKETS_PER_SEGMENT 64
+
+struct RecordingFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t lepton_type;          // 2 or 3
+  uint32_t segments;             // per frame: 1 (Lepton 2) or 4 (Lepton 3)
+  uint32_t packets_per_segment;  // 60, or more with telemetry rows
+  uint32_t packet_size;          // 164
+  uint32_t record_size;
+  uint32_t reserved0;
+  uint64_t start_realtime_ns;    // CLOCK_REALTIME when recording started
+  uint64_t start_monotonic_ns;   // CLOCK_MONOTONIC at the same instant
+  uint8_t reserved1[8];
+};
+
+struct RecordingFrameHeader {
+  uint64_t seq;                              // frame sequence number assigned at capture
+  uint64_t ts_ns[RECORDING_MAX_SEGMENTS];    // CLOCK_MONOTONIC when each segment completed
+  uint32_t segments;
+  uint32_t flags;
+};
+
+static_assert(sizeof(RecordingFileHeader) == 64, "capture file header layout");
+static_assert(sizeof(RecordingFrameHeader) == 48, "capture record header layout");
+
+static inline uint32_t recording_record_size(uint32_t segments, uint32_t packets_per_segment) {
+  uint32_t n = sizeof(RecordingFrameHeader) + segments * packets_per_segment * PACKET_SIZE;
+  return (n + 7) & ~7u;
+}
+
+// Appends frames from the capture thread through a writer thread, so the capture thread
+// never waits on storage. Frames that arrive while the queue is full are dropped and counted.
+class RecordingWriter {
+public:
+  RecordingWriter();
+  ~RecordingWriter();
+
+  bool open(const char *path, int leptonType, int segments, int packetsPerSegment);
+  void close();
+
+  // Queue one frame; `segs[i]` points at segment i's packets. Capture thread only.
+  bool submit(uint64_t seq, const uint64_t *ts_ns, const uint8_t *const *segs);
+
+  unsigned long written() const { return nwritten.load(); }
+  unsigned long dropped() const { return ndropped; }
+
+private:
+  struct Slot {
+    RecordingFrameHeader hdr;
+    uint8_t packets[RECORDING_MAX_SEGMENTS * RECORDING_MAX_PACKETS_PER_SEGMENT * PACKET_SIZE];
+  };
+
+  static void *writer_main(void *self);
+  void run();
+
+  int fd;
+  int segments, packetsPerSegment;
+  uint32_t recordSize;
+  SpscRing<Slot, 8> queue;
+  sem_t pending;
+  pthread_t writer;
+  std::atomic<bool> running;
+  std::atomic<unsigned long> nwritten;
+  unsigned long ndropped;
+};
+
+// Read-only, memory-mapped view of a capture file.
+class RecordingReader {
+public:
+  RecordingReader();
+  ~RecordingReader();
+
+  bool open(const char *path);
+  void close();
+
+  const RecordingFileHeader *header() const { return hdr; }
+  size_t frames() const { return nframes; }
+
+  // O(1) access to frame i (i < frames()).
+  const RecordingFrameHeader *frame(size_t i) const;
+  const uint8_t *packets(size_t i) const { return (const uint8_t *)(frame(i) + 1); }
+
+  // Does `path` start with a capture file header?
+  static bool probe(const char *path);
+
+private:
+  const uint8_t *map;
+  size_t mapsiz;
+  const RecordingFileHeader *hdr;
+  size_t nframes;
+};
+
+#endif
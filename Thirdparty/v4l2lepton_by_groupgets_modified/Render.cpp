@@ -0,0 +1,300 @@
+#include <string.h>
+#include <linux/videodev2.h>
+
+#include "Render.h"
+
+#define PIXELS_PER_PACKET 80
+
+// Sensor geometry: a VoSPI image packet carries half a row on a Lepton 3, a whole row on a
+// Lepton 2.
+struct Lepton2Geometry { enum { width = 80, height = 60, segments = 1, packetsPerRow = 1 }; };
+struct Lepton3Geometry { enum { width = 160, height = 120, segments = 4, packetsPerRow = 2 }; };
+
+static constexpr int frame_bytes(OutFmt fmt, int w, int h) {
+  return (fmt == OUT_RGB24) ? 3 * w * h
+       : (fmt == OUT_Y16 || fmt == OUT_YUYV) ? 2 * w * h
+       : (fmt == OUT_GREY) ? w * h
+       : w * h * 3 / 2;
+}
+
+static const struct { const char *name; uint32_t fourcc; } out_fmts[OUT_COUNT] = {
+  { "rgb",  V4L2_PIX_FMT_RGB24 },
+  { "y16",  V4L2_PIX_FMT_Y16 },
+  { "grey", V4L2_PIX_FMT_GREY },
+  { "yuyv", V4L2_PIX_FMT_YUYV },
+  { "nv12", V4L2_PIX_FMT_NV12 },
+  { "i420", V4L2_PIX_FMT_YUV420 },
+};
+
+bool out_fmt_parse(const char *s, OutFmt *fmt) {
+  for (int i = 0; i < OUT_COUNT; i++) {
+    if (strcmp(s, out_fmts[i].name) == 0) {
+      *fmt = (OutFmt)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t out_fmt_fourcc(OutFmt fmt) {
+  return out_fmts[fmt].fourcc;
+}
+
+int out_fmt_bytes_per_line(OutFmt fmt, int width) {
+  return (fmt == OUT_RGB24) ? 3 * width : (fmt == OUT_Y16 || fmt == OUT_YUYV) ? 2 * width : width;
+}
+
+int out_fmt_frame_bytes(OutFmt fmt, int width, int height) {
+  return frame_bytes(fmt, width, height);
+}
+
+// Interleaved Y, U, V per pixel -> the output layout; chroma is averaged over the pixels that
+// share it. RGB24 is rendered in place and Y16 is raw, so neither is packed.
+template <OutFmt F>
+static void pack_yuv(uint8_t *out, const uint8_t *yuv, int w, int h) {
+  (void)out; (void)yuv; (void)w; (void)h;
+}
+
+template <> void pack_yuv<OUT_GREY>(uint8_t *out, const uint8_t *yuv, int w, int h) {
+  for (int i = 0; i < w * h; i++) out[i] = yuv[3 * i];
+}
+
+template <> void pack_yuv<OUT_YUYV>(uint8_t *out, const uint8_t *yuv, int w, int h) {
+  for (int i = 0; i < w * h; i += 2, yuv += 6, out += 4) {
+    out[0] = yuv[0];
+    out[1] = (uint8_t)((yuv[1] + yuv[4] + 1) >> 1);
+    out[2] = yuv[3];
+    out[3] = (uint8_t)((yuv[2] + yuv[5] + 1) >> 1);
+  }
+}
+
+// Y plane, then for each 2x2 block the average U and V into `u`/`v`, `step` bytes apart.
+static void pack_420(uint8_t *y, uint8_t *u, uint8_t *v, int step, const uint8_t *yuv, int w, int h) {
+  for (int i = 0; i < w * h; i++) y[i] = yuv[3 * i];
+  for (int r = 0; r < h; r += 2) {
+    const uint8_t *a = yuv + 3 * r * w;       // row r
+    const uint8_t *b = a + 3 * w;             // row r + 1
+    for (int c = 0; c < w; c += 2, a += 6, b += 6, u += step, v += step) {
+      *u = (uint8_t)((a[1] + a[4] + b[1] + b[4] + 2) >> 2);
+      *v = (uint8_t)((a[2] + a[5] + b[2] + b[5] + 2) >> 2);
+    }
+  }
+}
+
+template <> void pack_yuv<OUT_NV12>(uint8_t *out, const uint8_t *yuv, int w, int h) {
+  uint8_t *uv = out + w * h;
+  pack_420(out, uv, uv + 1, 2, yuv, w, h);
+}
+
+template <> void pack_yuv<OUT_I420>(uint8_t *out, const uint8_t *yuv, int w, int h) {
+  uint8_t *u = out + w * h;
+  pack_420(out, u, u + w * h / 4, 1, yuv, w, h);
+}
+
+// Every pixel of a frame without data: the palette's black entry.
+static void fill_black(uint8_t *dst, int n, uint32_t c) {
+  for (int i = 0; i < n; i++, dst += 3) {
+    dst[0] = (uint8_t)c;
+    dst[1] = (uint8_t)(c >> 8);
+    dst[2] = (uint8_t)(c >> 16);
+  }
+}
+
+void frame_stats_reset(FrameStats *fs, uint32_t *hist, int histShift) {
+  for (int i = 0; i < 4; i++) {
+    fs->segMin[i] = 0xFFFF;
+    fs->segMax[i] = 0;
+  }
+  fs->hist = hist;
+  fs->histShift = histShift;
+  fs->histSegs = 0;
+  if (hist) memset(hist, 0, AGC_BINS * sizeof(uint32_t));
+}
+
+bool frame_stats_range(const FrameStats *fs, int segments, uint16_t *minV, uint16_t *maxV) {
+  uint16_t lo = 0xFFFF, hi = 0;
+  for (int i = 0; i < segments; i++) {
+    if (fs->segMin[i] < lo) lo = fs->segMin[i];
+    if (fs->segMax[i] > hi) hi = fs->segMax[i];
+  }
+  *minV = lo;
+  *maxV = hi;
+  return hi != 0;
+}
+
+static void hist_add(uint32_t *hist, int shift, const uint16_t *pix, int n, uint32_t delta) {
+  for (int i = 0; i < n; i++) {
+    if (pix[i]) hist[agc_bin(pix[i], shift)] += delta;
+  }
+}
+
+// Image packets of a frame are consecutive runs of PIXELS_PER_PACKET pixels in the plane
+// (two per row on a Lepton 3), so a segment's pixels are one contiguous span.
+template <class G>
+static void decode(uint16_t *pix, const uint8_t *src, int segno, const SegmentLayout *l,
+                   const RenderKernels *k, FrameStats *fs, Telemetry *tele) {
+  const int imagePackets = PACKETS_PER_FRAME * G::segments;
+  const int first = (segno - 1) * l->packetsPerSeg;   // frame packet index of this segment's packet 0
+  int imgLo = imagePackets, imgHi = 0;                 // image packets this segment carries
+
+  for (int p = 0; p < l->packetsPerSeg; p++) {
+    const int img = first + p - l->imageStart;
+    if (img < 0 || img >= imagePackets) {
+      if (first + p == l->rowA) parse_telemetry_row_a(src + PACKET_SIZE * p, tele);
+      continue;
+    }
+    if (img < imgLo) imgLo = img;
+    imgHi = img + 1;
+  }
+
+  const int seg = segno - 1;
+  const unsigned bit = 1u << seg;
+  uint16_t *span = pix + imgLo * PIXELS_PER_PACKET;
+  const int n = (imgHi > imgLo) ? (imgHi - imgLo) * PIXELS_PER_PACKET : 0;
+
+  // A repeated segment takes its old pixels out of the histogram before they are overwritten.
+  if (fs->hist && (fs->histSegs & bit)) hist_add(fs->hist, fs->histShift, span, n, (uint32_t)-1);
+
+  for (int img = imgLo; img < imgHi; img++) {
+    const int p = img + l->imageStart - first;
+    k->swap16(pix + img * PIXELS_PER_PACKET, src + PACKET_SIZE * p + 4, PIXELS_PER_PACKET);
+  }
+
+  if (!k->minmax(span, n, &fs->segMin[seg], &fs->segMax[seg])) {
+    fs->segMin[seg] = 0xFFFF;
+    fs->segMax[seg] = 0;
+  }
+  if (fs->hist) {
+    hist_add(fs->hist, fs->histShift, span, n, 1);
+    fs->histSegs |= bit;
+  }
+}
+
+// Refill `t` for a frame spanning [minV, maxV] unless it already covers that range with the
+// same scale and palette. Values outside the range cannot occur in this frame, so they are
+// left stale.
+static void y16_lut_update(Y16RgbLut *t, const LinearScale *s, uint16_t minV, uint16_t maxV,
+                           const uint32_t *palette) {
+  if (t->valid && t->scaleMin == s->min && t->scaleMax == s->max && t->palette == palette &&
+      t->lo <= minV && maxV <= t->hi) {
+    return;
+  }
+  for (uint32_t v = minV; v <= maxV; v++) t->rgbx[v] = palette[linear_index((uint16_t)v, s)];
+  t->rgbx[0] = palette[PALETTE_BLACK];
+  t->valid = true;
+  t->lo = minV;
+  t->hi = maxV;
+  t->scaleMin = s->min;
+  t->scaleMax = s->max;
+  t->palette = palette;
+}
+
+// Fill `t` over [minV, maxV] from an equalisation transfer function (index << 8 per bin).
+static void y16_lut_fill(Y16RgbLut *t, const uint16_t *tfQ8, int shift, uint16_t minV, uint16_t maxV,
+                         const uint32_t *palette) {
+  for (uint32_t v = minV; v <= maxV; v++) t->rgbx[v] = palette[(tfQ8[agc_bin((uint16_t)v, shift)] + 128) >> 8];
+  t->rgbx[0] = palette[PALETTE_BLACK];
+  t->valid = false;
+}
+
+template <class G, AgcMode A>
+static void analyse(const uint16_t *pix, const FrameStats *fs, AgcEngine *agc, ClaheEngine *clahe,
+                    RenderStats *st) {
+  st->valid = frame_stats_range(fs, G::segments, &st->minV, &st->maxV);
+  if (!st->valid) return;
+
+  if (A == AGC_CLAHE) {
+    st->index = clahe->apply(pix, st->minV, st->maxV);
+  } else if (A == AGC_HEQ) {
+    st->tfQ8 = agc->equalize(fs->hist, fs->histShift, st->minV, st->maxV);
+    st->tfShift = fs->histShift;
+  } else {
+    st->scale = agc->linear((A == AGC_CLIP) ? fs->hist : NULL, fs->histShift, st->minV, st->maxV);
+  }
+}
+
+// Palette entries (3 bytes per pixel) for a frame with data, by AGC mode.
+template <AgcMode A>
+static void map_frame(uint8_t *dst, const uint16_t *pix, int npix, const RenderContext *ctx,
+                      const RenderStats *st) {
+  if (A == AGC_CLAHE) {
+    // Per-pixel palette indices, so the palette itself is the lookup table.
+    ctx->kernels->map_lut(dst, st->index, npix, ctx->palette);
+    return;
+  }
+
+  if (A == AGC_HEQ) {
+    y16_lut_fill(ctx->y16Lut, st->tfQ8, st->tfShift, st->minV, st->maxV, ctx->palette);
+    ctx->kernels->map_lut(dst, pix, npix, ctx->y16Lut->rgbx);
+    return;
+  }
+
+  if (ctx->y16Lut) {
+    y16_lut_update(ctx->y16Lut, &st->scale, st->minV, st->maxV, ctx->palette);
+    ctx->kernels->map_lut(dst, pix, npix, ctx->y16Lut->rgbx);
+  } else {
+    ctx->kernels->map_rgb(dst, pix, npix, &st->scale, ctx->palette);
+  }
+}
+
+template <class G, OutFmt F, AgcMode A>
+static void render(const uint16_t *pix, const RenderStats *st, const RenderContext *ctx) {
+  const int npix = G::width * G::height;
+
+  if (F == OUT_Y16) {
+    // Raw counts, no AGC: pixels without data stay 0. Y16 is little-endian, like the host.
+    memcpy(ctx->out, pix, npix * sizeof(uint16_t));
+    return;
+  }
+
+  // RGB24 at the sensor size is mapped straight into the output. Otherwise the palette
+  // entries (RGB, or Y, U, V through the YUV palette) are staged, scaled, and packed.
+  uint8_t *dst = (F == OUT_RGB24 && !ctx->scaler) ? ctx->out : ctx->stage;
+
+  if (!st->valid) {
+    fill_black(dst, npix, ctx->palette[PALETTE_BLACK]);
+  } else {
+    map_frame<A>(dst, pix, npix, ctx, st);
+  }
+
+  int w = G::width, h = G::height;
+  if (ctx->scaler) {
+    uint8_t *big = (F == OUT_RGB24) ? ctx->out : ctx->scaled;
+    ctx->scaler->run(big, dst);
+    dst = big;
+    w = ctx->scaler->width();
+    h = ctx->scaler->height();
+  }
+  pack_yuv<F>(ctx->out, dst, w, h);
+}
+
+#define RENDER_PATH(G, F, A, name) \
+  { name, G::width, G::height, frame_bytes(F, G::width, G::height), decode<G>, analyse<G, A>, \
+    render<G, F, A> }
+
+#define RENDER_AGC_PATHS(G, F, L) \
+  { RENDER_PATH(G, F, AGC_LINEAR, L " linear"), \
+    RENDER_PATH(G, F, AGC_CLIP,   L " clip"), \
+    RENDER_PATH(G, F, AGC_HEQ,    L " heq"), \
+    RENDER_PATH(G, F, AGC_CLAHE,  L " clahe") }
+
+// Y16 is raw, so its AGC variants all do the same.
+#define RENDER_PATHS(G, L) \
+  { RENDER_AGC_PATHS(G, OUT_RGB24, L " rgb24"), \
+    RENDER_AGC_PATHS(G, OUT_Y16,   L " y16"), \
+    RENDER_AGC_PATHS(G, OUT_GREY,  L " grey"), \
+    RENDER_AGC_PATHS(G, OUT_YUYV,  L " yuyv"), \
+    RENDER_AGC_PATHS(G, OUT_NV12,  L " nv12"), \
+    RENDER_AGC_PATHS(G, OUT_I420,  L " i420") }
+
+static const RenderPath paths[2][OUT_COUNT][AGC_COUNT] = {
+  RENDER_PATHS(Lepton2Geometry, "L2"),
+  RENDER_PATHS(Lepton3Geometry, "L3"),
+};
+
+const RenderPath *render_path_select(int typeLepton, OutFmt fmt, AgcMode agc) {
+  if ((typeLepton != 2 && typeLepton != 3) || fmt < 0 || fmt >= OUT_COUNT || agc < 0 || agc >= AGC_COUNT) {
+    return NULL;
+  }
+  return &paths[typeLepton - 2][fmt][agc];
+}
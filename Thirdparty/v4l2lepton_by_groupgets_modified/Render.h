@@ -0,0 +1,124 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "VoSPI.h"
+#include "RenderKernels.h"
+#include "Agc.h"
+#include "Clahe.h"
+#include "Scaler.h"
+
+// Decode and render paths, specialised at compile time per sensor geometry, output format
+// and AGC mode (Render.cpp instantiates every combination). main() picks one RenderPath per
+// output at startup, so no per-pixel or per-packet code branches on these settings. A new
+// format or AGC mode is a new enum value plus its case in the render template.
+//
+// A frame is decoded and analysed (range and AGC mapping) once, then rendered into every
+// output from the same RenderStats; the outputs share sensor and AGC mode, and differ in
+// format, palette and size.
+
+// Output pixel formats. The YUV ones are BT.601, rendered through the palette converted to
+// YUV at build time, so consumers can feed an encoder without a colour conversion.
+enum OutFmt {
+  OUT_RGB24 = 0,
+  OUT_Y16 = 1,                // raw counts, little-endian
+  OUT_GREY = 2,               // full-range luma of the palette
+  OUT_YUYV = 3,               // 4:2:2 packed
+  OUT_NV12 = 4,               // 4:2:0, Y plane + interleaved UV plane
+  OUT_I420 = 5,               // 4:2:0, Y, U and V planes
+  OUT_COUNT
+};
+
+// "rgb", "y16", "grey", "yuyv", "nv12" or "i420". Returns false for anything else.
+bool out_fmt_parse(const char *s, OutFmt *fmt);
+
+// V4L2 pixel format, and the bytes per line of its first plane.
+uint32_t out_fmt_fourcc(OutFmt fmt);
+int out_fmt_bytes_per_line(OutFmt fmt, int width);
+
+// Size of one width x height image.
+int out_fmt_frame_bytes(OutFmt fmt, int width, int height);
+
+// Where the image and telemetry packets sit within a frame's segments.
+struct SegmentLayout {
+  int packetsPerSeg;
+  int imageStart;             // frame packet index of the first image packet
+  int rowA;                   // frame packet index of telemetry row A, -1 = none
+};
+
+// Pixel statistics of a frame, gathered segment by segment as each one is decoded (while it
+// is still in L1), so the AGC range is known the moment the last segment lands and the
+// render is a single pass over the frame.
+struct FrameStats {
+  uint16_t segMin[4], segMax[4];   // nonzero pixels per segment; segMax 0 = none
+  uint32_t *hist;                  // AGC_BINS counts of nonzero pixels, NULL = not kept
+  int histShift;                   // hist bins are agc_bin(v, histShift)
+  unsigned histSegs;               // bitmask of segments counted into hist
+};
+
+// Start a new frame. `hist`, if given, is cleared and kept from now on.
+void frame_stats_reset(FrameStats *fs, uint32_t *hist, int histShift);
+
+// Nonzero range over every segment. Returns false if the frame has no data.
+bool frame_stats_range(const FrameStats *fs, int segments, uint16_t *minV, uint16_t *maxV);
+
+// Direct pixel value -> RGBX table (256 KB), so RGB output is one lookup per pixel. Only
+// the frame's [lo, hi] range and entry 0 are filled. With a linear AGC it is refilled when
+// the AGC range or the palette changes, which on a static scene is rarely; heq fills it from
+// the transfer function every frame.
+struct Y16RgbLut {
+  uint32_t rgbx[65536];
+  bool valid;                 // filled from a linear scale, reusable while the key matches
+  uint16_t lo, hi;            // filled range
+  uint16_t scaleMin, scaleMax;
+  const uint32_t *palette;    // palette the table was filled from
+};
+
+// Per-output state a render path reads and writes besides the frame itself.
+struct RenderContext {
+  const RenderKernels *kernels;
+  const uint32_t *palette;    // PALETTE_RGBX_SIZE entries, RGB or YUV to suit the output
+  Y16RgbLut *y16Lut;          // NULL = map through rgbLut per pixel (AGC_HEQ needs one)
+  Scaler *scaler;             // NULL = output at the sensor size
+  uint8_t *out;               // output image, out_fmt_frame_bytes() of the output size
+  uint8_t *stage;             // palette entries per sensor pixel, unless mapped into `out`;
+                              // outputs rendered one after the other can share it
+  uint8_t *scaled;            // YUV formats with a scaler: Y, U, V per output pixel
+};
+
+// A frame's AGC result, shared by every output that renders it.
+struct RenderStats {
+  bool valid;                 // the frame has pixels; the rest is set only then
+  uint16_t minV, maxV;
+  LinearScale scale;          // AGC_LINEAR, AGC_CLIP
+  const uint16_t *tfQ8;       // AGC_HEQ: transfer function, index << 8 per histogram bin
+  int tfShift;                // its bins are agc_bin(v, tfShift)
+  const uint16_t *index;      // AGC_CLAHE: palette index per pixel
+};
+
+struct RenderPath {
+  const char *name;
+  int width, height;
+  int frameBytes;             // size of one output image at the sensor size
+
+  // Decode segment `segno` (1-based) from `src` into the host-order `pix` plane and add it
+  // to `fs`; telemetry row A, if the segment carries it, is parsed into `tele`. A segment
+  // decoded again replaces its earlier contribution.
+  void (*decode)(uint16_t *pix, const uint8_t *src, int segno, const SegmentLayout *l,
+                 const RenderKernels *k, FrameStats *fs, Telemetry *tele);
+
+  // Range and AGC mapping of a complete frame. Stateful AGC (damping) advances, so this runs
+  // once per frame however many outputs render it; any output's path will do.
+  void (*analyse)(const uint16_t *pix, const FrameStats *fs, AgcEngine *agc, ClaheEngine *clahe,
+                  RenderStats *st);
+
+  // Render an analysed frame into ctx->out, scaled if ctx->scaler is set.
+  void (*render)(const uint16_t *pix, const RenderStats *st, const RenderContext *ctx);
+};
+
+// Returns NULL for a combination that does not exist.
+const RenderPath *render_path_select(int typeLepton, OutFmt fmt, AgcMode agc);
+
+#endif
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "RenderKernels.h"
+
+// filter_rows: Q14 weights times Q6 samples, back to 8 bits.
+#define FILTER_SHIFT 20
+#define FILTER_ROUND (1 << (FILTER_SHIFT - 1))
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// 64-bit ARM always has NEON. 32-bit ARM builds only get the NEON set when compiled with
+// -mfpu=neon (Raspberry Pi OS armhf defaults to VFP only) and the CPU reports it.
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS 1
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// ---------------------------------------------------------------------------
+// scalar
+
+static void swap16_scalar(uint16_t *dst, const uint8_t *src, int n) {
+  for (int i = 0; i < n; i++) dst[i] = (uint16_t)((src[2*i] << 8) | src[2*i+1]);
+}
+
+static bool minmax_scalar(const uint16_t *pix, int n, uint16_t *minV, uint16_t *maxV) {
+  uint16_t lo = 65535, hi = 0;
+  for (int i = 0; i < n; i++) {
+    uint16_t v = pix[i];
+    if (v == 0) continue;
+    if (v < lo) lo = v;
+    if (v > hi) hi = v;
+  }
+  *minV = lo;
+  *maxV = hi;
+  return hi != 0;
+}
+
+static inline void put_rgb(uint8_t *dst, uint32_t c) {
+  dst[0] = (uint8_t)c;
+  dst[1] = (uint8_t)(c >> 8);
+  dst[2] = (uint8_t)(c >> 16);
+}
+
+static void map_rgb_scalar(uint8_t *dst, const uint16_t *pix, int n, const LinearScale *s, const uint32_t *lut) {
+  for (int i = 0; i < n; i++) {
+    uint16_t v = pix[i];
+    put_rgb(dst + 3 * i, lut[v ? linear_index(v, s) : PALETTE_BLACK]);
+  }
+}
+
+static void map_lut_scalar(uint8_t *dst, const uint16_t *pix, int n, const uint32_t *lut) {
+  for (int i = 0; i < n; i++) put_rgb(dst + 3 * i, lut[pix[i]]);
+}
+
+static void filter_rows_scalar(uint8_t *dst, const int16_t *const *rows, const int16_t *w, int taps, int n) {
+  for (int i = 0; i < n; i++) {
+    int32_t acc = FILTER_ROUND;
+    for (int t = 0; t < taps; t++) acc += w[t] * rows[t][i];
+    acc >>= FILTER_SHIFT;
+    dst[i] = (uint8_t)((acc < 0) ? 0 : (acc > 255) ? 255 : acc);
+  }
+}
+
+static const RenderKernels kernels_scalar = {
+  "scalar", swap16_scalar, minmax_scalar, map_rgb_scalar, map_lut_scalar, filter_rows_scalar
+};
+
+// ---------------------------------------------------------------------------
+// SSE2 (baseline on x86-64). No unsigned 16-bit min/max and no gather: the sign bit is
+// flipped for the comparisons, and palette lookups stay scalar behind vector index math.
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void swap16_sse2(uint16_t *dst, const uint8_t *src, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    _mm_storeu_si128((__m128i *)(dst + i), x);
+  }
+  swap16_scalar(dst + i, src + 2 * i, n - i);
+}
+
+__attribute__((target("sse2")))
+static bool minmax_sse2(const uint16_t *pix, int n, uint16_t *minV, uint16_t *maxV) {
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_set1_epi16(0x7FFF);            // 0xFFFF, sign-flipped
+  __m128i hi = sign;                              // 0, sign-flipped
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pix + i));
+    __m128i nodata = _mm_cmpeq_epi16(v, zero);
+    lo = _mm_min_epi16(lo, _mm_xor_si128(_mm_or_si128(v, nodata), sign));
+    hi = _mm_max_epi16(hi, _mm_xor_si128(v, sign));
+  }
+  uint16_t l[8], h[8];
+  _mm_storeu_si128((__m128i *)l, _mm_xor_si128(lo, sign));
+  _mm_storeu_si128((__m128i *)h, _mm_xor_si128(hi, sign));
+
+  uint16_t tl, th;
+  minmax_scalar(pix + i, n - i, &tl, &th);
+  for (int k = 0; k < 8; k++) {
+    if (l[k] < tl) tl = l[k];
+    if (h[k] > th) th = h[k];
+  }
+  *minV = tl;
+  *maxV = th;
+  return th != 0;
+}
+
+__attribute__((target("sse2")))
+static void map_rgb_sse2(uint8_t *dst, const uint16_t *pix, int n, const LinearScale *s, const uint32_t *lut) {
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  const __m128i smin = _mm_set1_epi16((short)(s->min ^ 0x8000));   // clamp bounds, sign-flipped
+  const __m128i smax = _mm_set1_epi16((short)(s->max ^ 0x8000));
+  const __m128i vmin = _mm_set1_epi16((short)s->min);
+  const __m128i vmul = _mm_set1_epi16((short)s->mul);
+  const __m128i vshift = _mm_cvtsi32_si128(s->shift);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i black = _mm_set1_epi16(PALETTE_BLACK);
+  uint16_t idx[8];
+  int i = 0;
+
+  // 4-byte stores run one byte into the next pixel, so the last pixel is left to the tail.
+  for (; i + 8 < n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pix + i));
+    __m128i c = _mm_xor_si128(_mm_min_epi16(_mm_max_epi16(_mm_xor_si128(v, sign), smin), smax), sign);
+    __m128i d = _mm_sll_epi16(_mm_sub_epi16(c, vmin), vshift);
+    __m128i x = _mm_mulhi_epu16(d, vmul);
+    __m128i nodata = _mm_cmpeq_epi16(v, zero);
+    x = _mm_or_si128(_mm_andnot_si128(nodata, x), _mm_and_si128(nodata, black));
+    _mm_storeu_si128((__m128i *)idx, x);
+    uint8_t *o = dst + 3 * i;
+    for (int k = 0; k < 8; k++) memcpy(o + 3 * k, &lut[idx[k]], 4);
+  }
+  map_rgb_scalar(dst + 3 * i, pix + i, n - i, s, lut);
+}
+
+__attribute__((target("sse2")))
+static void map_lut_sse2(uint8_t *dst, const uint16_t *pix, int n, const uint32_t *lut) {
+  int i = 0;
+  for (; i + 1 < n; i++) memcpy(dst + 3 * i, &lut[pix[i]], 4);   // last pixel: exact 3 bytes
+  map_lut_scalar(dst + 3 * i, pix + i, n - i, lut);
+}
+
+// Taps go in pairs: the two rows are interleaved so one madd weights both.
+__attribute__((target("sse2")))
+static void filter_rows_sse2(uint8_t *dst, const int16_t *const *rows, const int16_t *w, int taps, int n) {
+  const __m128i round = _mm_set1_epi32(FILTER_ROUND);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i lo = round, hi = round;
+    for (int t = 0; t < taps; t += 2) {
+      const __m128i wp = _mm_set1_epi32((int)(((uint32_t)(uint16_t)w[t + 1] << 16) | (uint16_t)w[t]));
+      __m128i a = _mm_loadu_si128((const __m128i *)(rows[t] + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(rows[t + 1] + i));
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+    }
+    __m128i x = _mm_packs_epi32(_mm_srai_epi32(lo, FILTER_SHIFT), _mm_srai_epi32(hi, FILTER_SHIFT));
+    _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(x, x));
+  }
+  const int16_t *tail[4];
+  for (int t = 0; t < taps; t++) tail[t] = rows[t] + i;
+  filter_rows_scalar(dst + i, tail, w, taps, n - i);
+}
+
+static const RenderKernels kernels_sse2 = {
+  "sse2", swap16_sse2, minmax_sse2, map_rgb_sse2, map_lut_sse2, filter_rows_sse2
+};
+
+// ---------------------------------------------------------------------------
+// AVX2: 16 pixels per step, palette gathered 8 entries at a time.
+
+__attribute__((target("avx2")))
+static void swap16_avx2(uint16_t *dst, const uint8_t *src, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(src + 2 * i));
+    x = _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8));
+    _mm256_storeu_si256((__m256i *)(dst + i), x);
+  }
+  swap16_sse2(dst + i, src + 2 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static bool minmax_avx2(const uint16_t *pix, int n, uint16_t *minV, uint16_t *maxV) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_set1_epi16((short)0xFFFF);
+  __m256i hi = zero;
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(pix + i));
+    lo = _mm256_min_epu16(lo, _mm256_or_si256(v, _mm256_cmpeq_epi16(v, zero)));
+    hi = _mm256_max_epu16(hi, v);
+  }
+  __m128i l = _mm_min_epu16(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+  __m128i h = _mm_max_epu16(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+  // minpos finds the lane minimum; the maximum is the minimum of the complement.
+  uint16_t vl = (uint16_t)_mm_cvtsi128_si32(_mm_minpos_epu16(l));
+  uint16_t vh = (uint16_t)~_mm_cvtsi128_si32(_mm_minpos_epu16(_mm_xor_si128(h, _mm_set1_epi16((short)0xFFFF))));
+
+  uint16_t tl, th;
+  minmax_scalar(pix + i, n - i, &tl, &th);
+  *minV = (vl < tl) ? vl : tl;
+  *maxV = (vh > th) ? vh : th;
+  return *maxV != 0;
+}
+
+// 16 RGBX words (c0: pixels 0-7, c1: 8-15) -> 48 bytes of RGB24. Every 16-byte store carries
+// 12 bytes of output, so callers stop while 4 spare bytes remain (i + 18 <= n).
+__attribute__((target("avx2")))
+static inline void store_rgbx16_avx2(uint8_t *o, __m256i c0, __m256i c1) {
+  // RGBx RGBx RGBx RGBx -> RGBRGBRGBRGB in each 128-bit lane
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  c0 = _mm256_shuffle_epi8(c0, pack);
+  c1 = _mm256_shuffle_epi8(c1, pack);
+  _mm_storeu_si128((__m128i *)(o +  0), _mm256_castsi256_si128(c0));
+  _mm_storeu_si128((__m128i *)(o + 12), _mm256_extracti128_si256(c0, 1));
+  _mm_storeu_si128((__m128i *)(o + 24), _mm256_castsi256_si128(c1));
+  _mm_storeu_si128((__m128i *)(o + 36), _mm256_extracti128_si256(c1, 1));
+}
+
+__attribute__((target("avx2")))
+static void map_rgb_avx2(uint8_t *dst, const uint16_t *pix, int n, const LinearScale *s, const uint32_t *lut) {
+  const __m256i vmin = _mm256_set1_epi16((short)s->min);
+  const __m256i vmax = _mm256_set1_epi16((short)s->max);
+  const __m256i vmul = _mm256_set1_epi16((short)s->mul);
+  const __m128i vshift = _mm_cvtsi32_si128(s->shift);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i black = _mm256_set1_epi16(PALETTE_BLACK);
+  int i = 0;
+
+  for (; i + 18 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(pix + i));
+    __m256i c = _mm256_min_epu16(_mm256_max_epu16(v, vmin), vmax);
+    __m256i d = _mm256_sll_epi16(_mm256_sub_epi16(c, vmin), vshift);
+    __m256i x = _mm256_mulhi_epu16(d, vmul);
+    x = _mm256_blendv_epi8(x, black, _mm256_cmpeq_epi16(v, zero));
+
+    __m256i c0 = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(x)), 4);
+    __m256i c1 = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(x, 1)), 4);
+    store_rgbx16_avx2(dst + 3 * i, c0, c1);
+  }
+  map_rgb_sse2(dst + 3 * i, pix + i, n - i, s, lut);
+}
+
+__attribute__((target("avx2")))
+static void map_lut_avx2(uint8_t *dst, const uint16_t *pix, int n, const uint32_t *lut) {
+  int i = 0;
+  for (; i + 18 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(pix + i));
+    __m256i c0 = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), 4);
+    __m256i c1 = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), 4);
+    store_rgbx16_avx2(dst + 3 * i, c0, c1);
+  }
+  map_lut_sse2(dst + 3 * i, pix + i, n - i, lut);
+}
+
+// As SSE2, 16 samples per step. Unpack and pack both work within 128-bit lanes, so the
+// samples come out in order in each lane and only the final bytes need gathering.
+__attribute__((target("avx2")))
+static void filter_rows_avx2(uint8_t *dst, const int16_t *const *rows, const int16_t *w, int taps, int n) {
+  const __m256i round = _mm256_set1_epi32(FILTER_ROUND);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i lo = round, hi = round;
+    for (int t = 0; t < taps; t += 2) {
+      const __m256i wp = _mm256_set1_epi32((int)(((uint32_t)(uint16_t)w[t + 1] << 16) | (uint16_t)w[t]));
+      __m256i a = _mm256_loadu_si256((const __m256i *)(rows[t] + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(rows[t + 1] + i));
+      lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wp));
+      hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wp));
+    }
+    __m256i x = _mm256_packs_epi32(_mm256_srai_epi32(lo, FILTER_SHIFT), _mm256_srai_epi32(hi, FILTER_SHIFT));
+    x = _mm256_permute4x64_epi64(_mm256_packus_epi16(x, x), 0x08);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(x));
+  }
+  const int16_t *tail[4];
+  for (int t = 0; t < taps; t++) tail[t] = rows[t] + i;
+  filter_rows_sse2(dst + i, tail, w, taps, n - i);
+}
+
+static const RenderKernels kernels_avx2 = {
+  "avx2", swap16_avx2, minmax_avx2, map_rgb_avx2, map_lut_avx2, filter_rows_avx2
+};
+
+#endif
+
+// ---------------------------------------------------------------------------
+// NEON: vector byte swap, min/max and index math; the palette is gathered into planes and
+// interleaved by vst3.
+
+#ifdef HAVE_NEON_KERNELS
+
+static void swap16_neon(uint16_t *dst, const uint8_t *src, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint8x16_t x = vrev16q_u8(vld1q_u8(src + 2 * i));
+    vst1q_u16(dst + i, vreinterpretq_u16_u8(x));
+  }
+  swap16_scalar(dst + i, src + 2 * i, n - i);
+}
+
+static bool minmax_neon(const uint16_t *pix, int n, uint16_t *minV, uint16_t *maxV) {
+  const uint16x8_t zero = vdupq_n_u16(0);
+  uint16x8_t lo = vdupq_n_u16(0xFFFF);
+  uint16x8_t hi = zero;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t v = vld1q_u16(pix + i);
+    lo = vminq_u16(lo, vorrq_u16(v, vceqq_u16(v, zero)));
+    hi = vmaxq_u16(hi, v);
+  }
+  uint16_t l[8], h[8];
+  vst1q_u16(l, lo);
+  vst1q_u16(h, hi);
+
+  uint16_t tl, th;
+  minmax_scalar(pix + i, n - i, &tl, &th);
+  for (int k = 0; k < 8; k++) {
+    if (l[k] < tl) tl = l[k];
+    if (h[k] > th) th = h[k];
+  }
+  *minV = tl;
+  *maxV = th;
+  return th != 0;
+}
+
+// lut[idx[0..7]] split into planes and interleaved into 24 bytes of RGB24 by vst3.
+static inline void store_rgb8_neon(uint8_t *o, const uint16_t *idx, const uint32_t *lut) {
+  uint8_t r[8], g[8], b[8];
+  for (int k = 0; k < 8; k++) {
+    uint32_t c = lut[idx[k]];
+    r[k] = (uint8_t)c;
+    g[k] = (uint8_t)(c >> 8);
+    b[k] = (uint8_t)(c >> 16);
+  }
+  uint8x8x3_t rgb;
+  rgb.val[0] = vld1_u8(r);
+  rgb.val[1] = vld1_u8(g);
+  rgb.val[2] = vld1_u8(b);
+  vst3_u8(o, rgb);
+}
+
+static void map_rgb_neon(uint8_t *dst, const uint16_t *pix, int n, const LinearScale *s, const uint32_t *lut) {
+  const uint16x8_t vmin = vdupq_n_u16(s->min);
+  const uint16x8_t vmax = vdupq_n_u16(s->max);
+  const uint16x4_t vmul = vdup_n_u16(s->mul);
+  const int16x8_t vshift = vdupq_n_s16((int16_t)s->shift);
+  const uint16x8_t zero = vdupq_n_u16(0);
+  const uint16x8_t black = vdupq_n_u16(PALETTE_BLACK);
+  uint16_t idx[8];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t v = vld1q_u16(pix + i);
+    uint16x8_t c = vminq_u16(vmaxq_u16(v, vmin), vmax);
+    uint16x8_t d = vshlq_u16(vsubq_u16(c, vmin), vshift);
+    uint16x4_t xl = vshrn_n_u32(vmull_u16(vget_low_u16(d), vmul), 16);
+    uint16x4_t xh = vshrn_n_u32(vmull_u16(vget_high_u16(d), vmul), 16);
+    uint16x8_t x = vbslq_u16(vceqq_u16(v, zero), black, vcombine_u16(xl, xh));
+    vst1q_u16(idx, x);
+
+    store_rgb8_neon(dst + 3 * i, idx, lut);
+  }
+  map_rgb_scalar(dst + 3 * i, pix + i, n - i, s, lut);
+}
+
+static void map_lut_neon(uint8_t *dst, const uint16_t *pix, int n, const uint32_t *lut) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) store_rgb8_neon(dst + 3 * i, pix + i, lut);
+  map_lut_scalar(dst + 3 * i, pix + i, n - i, lut);
+}
+
+static void filter_rows_neon(uint8_t *dst, const int16_t *const *rows, const int16_t *w, int taps, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t a = vld1q_s16(rows[0] + i);
+    int32x4_t lo = vmull_n_s16(vget_low_s16(a), w[0]);
+    int32x4_t hi = vmull_n_s16(vget_high_s16(a), w[0]);
+    for (int t = 1; t < taps; t++) {
+      a = vld1q_s16(rows[t] + i);
+      lo = vmlal_n_s16(lo, vget_low_s16(a), w[t]);
+      hi = vmlal_n_s16(hi, vget_high_s16(a), w[t]);
+    }
+    // Rounding shift, then saturate to 0..65535 and 0..255.
+    uint16x8_t x = vcombine_u16(vqmovun_s32(vrshrq_n_s32(lo, FILTER_SHIFT)),
+                                vqmovun_s32(vrshrq_n_s32(hi, FILTER_SHIFT)));
+    vst1_u8(dst + i, vqmovn_u16(x));
+  }
+  const int16_t *tail[4];
+  for (int t = 0; t < taps; t++) tail[t] = rows[t] + i;
+  filter_rows_scalar(dst + i, tail, w, taps, n - i);
+}
+
+static const RenderKernels kernels_neon = {
+  "neon", swap16_neon, minmax_neon, map_rgb_neon, map_lut_neon, filter_rows_neon
+};
+
+#endif
+
+// ---------------------------------------------------------------------------
+
+static bool cpu_has(const RenderKernels *k) {
+#ifdef HAVE_X86_KERNELS
+  if (k == &kernels_avx2) return __builtin_cpu_supports("avx2");
+  if (k == &kernels_sse2) return __builtin_cpu_supports("sse2");
+#endif
+#ifdef HAVE_NEON_KERNELS
+  if (k == &kernels_neon) {
+#if defined(__aarch64__)
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+  }
+#endif
+  return k == &kernels_scalar;
+}
+
+// Best first.
+static const RenderKernels *const all_kernels[] = {
+#ifdef HAVE_X86_KERNELS
+  &kernels_avx2, &kernels_sse2,
+#endif
+#ifdef HAVE_NEON_KERNELS
+  &kernels_neon,
+#endif
+  &kernels_scalar,
+};
+static const int nkernels = sizeof(all_kernels) / sizeof(all_kernels[0]);
+
+const RenderKernels *render_kernels_select(const char *want) {
+  bool any = (!want || strcmp(want, "auto") == 0);
+  for (int i = 0; i < nkernels; i++) {
+    const RenderKernels *k = all_kernels[i];
+    if ((any || strcmp(want, k->name) == 0) && cpu_has(k)) return k;
+  }
+  return NULL;
+}
+
+const char *render_kernels_available() {
+  static char names[64];
+  if (names[0]) return names;
+  for (int i = 0; i < nkernels; i++) {
+    if (!cpu_has(all_kernels[i])) continue;
+    if (names[0]) strncat(names, ",", sizeof(names) - strlen(names) - 1);
+    strncat(names, all_kernels[i]->name, sizeof(names) - strlen(names) - 1);
+  }
+  return names;
+}
@@ -0,0 +1,71 @@
+#ifndef RENDERKERNELS_H
+#define RENDERKERNELS_H
+
+#include <stdint.h>
+
+#include "Palettes.h"
+
+// Per-pixel loops of the render path, in a scalar version and SIMD versions (SSE2, AVX2,
+// NEON). One set is picked at startup from the CPU's features; all of them produce
+// bit-identical output.
+//
+// Pixel value 0 means "no data" throughout: it is left out of min/max and rendered black.
+
+// Linear 14-bit -> 8-bit mapping in fixed point, without a division per pixel:
+//   index = (((clamp(v, min, max) - min) << shift) * mul) >> 16
+// `shift` normalises the range to at least 256 so `mul` fits in 16 bits; `mul` is rounded up
+// so v == max lands on 255 (never above). Values outside [min, max] (a clipped or damped
+// AGC range) saturate at 0 and 255.
+struct LinearScale {
+  uint16_t min, max;
+  uint16_t shift;
+  uint16_t mul;     // 0 = flat frame, every pixel maps to index 0
+};
+
+static inline LinearScale linear_scale(uint16_t minV, uint16_t maxV) {
+  LinearScale s;
+  s.min = minV;
+  s.max = (maxV > minV) ? maxV : minV;
+  s.shift = 0;
+  s.mul = 0;
+  uint32_t range = (maxV > minV) ? (uint32_t)(maxV - minV) : 0;
+  if (range == 0) return s;
+  while ((range << s.shift) < 256) s.shift++;
+  uint32_t d = range << s.shift;
+  s.mul = (uint16_t)((255u * 65536u + d - 1) / d);
+  return s;
+}
+
+static inline uint8_t linear_index(uint16_t v, const LinearScale *s) {
+  v = (v < s->min) ? s->min : (v > s->max) ? s->max : v;
+  return (uint8_t)(((uint32_t)(uint16_t)((v - s->min) << s->shift) * s->mul) >> 16);
+}
+
+struct RenderKernels {
+  const char *name;
+
+  // `n` big-endian words from a VoSPI payload -> host order.
+  void (*swap16)(uint16_t *dst, const uint8_t *src, int n);
+
+  // Smallest and largest nonzero pixel. Returns false if every pixel is 0.
+  bool (*minmax)(const uint16_t *pix, int n, uint16_t *minV, uint16_t *maxV);
+
+  // RGB24 through a packed palette (PALETTE_RGBX_SIZE entries), zero pixels black.
+  void (*map_rgb)(uint8_t *dst, const uint16_t *pix, int n, const LinearScale *s, const uint32_t *lut);
+
+  // RGB24 straight from a 65536-entry RGBX table indexed by the pixel value.
+  void (*map_lut)(uint8_t *dst, const uint16_t *pix, int n, const uint32_t *lut);
+
+  // Vertical pass of the scaler, `taps` (2 or 4) rows of Q6 samples weighted by Q14 `w`:
+  //   dst[i] = clamp((sum w[t] * rows[t][i] + 2^19) >> 20, 0, 255)
+  void (*filter_rows)(uint8_t *dst, const int16_t *const *rows, const int16_t *w, int taps, int n);
+};
+
+// `want` is "auto" (or NULL) for the best set this CPU runs, or a set's name.
+// Returns NULL for an unknown or unsupported name.
+const RenderKernels *render_kernels_select(const char *want);
+
+// Names of the sets this build and CPU support, for --help and errors.
+const char *render_kernels_available();
+
+#endif
@@ -90,3 +90,46 @@ int SpiClosePort(void)
 	}
 	return(status_value);
 }
+
+//Largest number of packets one SPI_IOC_MESSAGE may carry: spidev rejects
+//messages whose total length exceeds its `bufsiz` module parameter (4096 by default)
+int SpiMaxBatch(int packet_size)
+{
+	int bufsiz = 4096;
+
+	FILE *f = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+	if (f)
+	{
+		if (fscanf(f, "%d", &bufsiz) != 1)
+			bufsiz = 4096;
+		fclose(f);
+	}
+
+	int n = bufsiz / packet_size;
+	if (n > SPI_BATCH_MAX)
+		n = SPI_BATCH_MAX;
+	return (n < 1) ? 1 : n;
+}
+
+//Clock `count` packets of `packet_size` bytes into `buf` with a single ioctl.
+//CS stays asserted between the chained transfers, exactly as with back-to-back read()s.
+//Returns the number of packets read, or -1 on failure.
+int SpiReadBatch(uint8_t *buf, int packet_size, int count)
+{
+	struct spi_ioc_transfer xfer[SPI_BATCH_MAX];
+
+	if (count < 1 || count > SPI_BATCH_MAX)
+		return -1;
+
+	memset(xfer, 0, sizeof(xfer[0]) * count);
+	for (int i = 0; i < count; i++)
+	{
+		xfer[i].rx_buf = (unsigned long)(buf + i * packet_size);
+		xfer[i].len = packet_size;
+		xfer[i].bits_per_word = spi_bitsPerWord;
+	}
+
+	if (ioctl(spi_cs_fd, SPI_IOC_MESSAGE(count), xfer) != count * packet_size)
+		return -1;
+	return count;
+}
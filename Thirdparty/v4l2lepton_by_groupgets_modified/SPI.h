@@ -19,12 +19,16 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
 
+//Upper bound on chained transfers per SPI_IOC_MESSAGE (one Lepton 3 segment + telemetry fits)
+#define SPI_BATCH_MAX 64
+
 extern int spi_cs_fd;
 extern unsigned char spi_mode;
 extern unsigned char spi_bitsPerWord;
@@ -32,5 +36,7 @@ extern unsigned int spi_speed;
 
 int SpiOpenPort(char *device);
 int SpiClosePort(void);
+int SpiMaxBatch(int packet_size);
+int SpiReadBatch(uint8_t *buf, int packet_size, int count);
 
 #endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "Scaler.h"
+
+#define WEIGHT_ONE (1 << 14)
+
+static const char *const filter_names[SCALE_COUNT] = { "nearest", "bilinear", "bicubic" };
+
+bool scale_filter_parse(const char *s, ScaleFilter *f) {
+  for (int i = 0; i < SCALE_COUNT; i++) {
+    if (strcmp(s, filter_names[i]) == 0) {
+      *f = (ScaleFilter)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *scale_filter_name(ScaleFilter f) {
+  return filter_names[f];
+}
+
+static uint64_t scaler_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Scaler::Scaler()
+  : filt(SCALE_BILINEAR), kernels(NULL), srcW(0), srcH(0), dstW(0), dstH(0), taps(0),
+    cols(NULL), rows(NULL), mid(NULL), last(NULL), lastDst(NULL),
+    lastNs(0), totalNs(0), frames(0), skipped(0) {}
+
+Scaler::~Scaler() {
+  free(cols);
+  free(rows);
+  free(mid);
+  free(last);
+}
+
+// Keys' cubic convolution kernel with a = -0.5.
+static double cubic(double x) {
+  x = fabs(x);
+  if (x < 1) return (1.5 * x - 2.5) * x * x + 1;
+  if (x < 2) return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+  return 0;
+}
+
+// Taps along one axis. Output sample i sits at source position (i + 0.5) * src / dst - 0.5,
+// so the image edges line up rather than the first and last sample centres.
+static void axis_taps(int src, int dst, ScaleFilter f, int taps, ScaleTaps *out) {
+  for (int i = 0; i < dst; i++) {
+    int *pos = out[i].pos;
+    int16_t *w = out[i].w;
+    double x = (i + 0.5) * src / dst - 0.5;
+    double wf[4] = { 1, 0, 0, 0 };
+    int first;
+
+    if (f == SCALE_NEAREST) {
+      first = (int)floor(x + 0.5);
+    } else if (f == SCALE_BILINEAR) {
+      first = (int)floor(x);
+      wf[1] = x - first;
+      wf[0] = 1 - wf[1];
+    } else {
+      first = (int)floor(x) - 1;
+      for (int t = 0; t < 4; t++) wf[t] = cubic(x - (first + t));
+    }
+
+    // Q14, with the rounding error put on the largest tap so a flat image stays flat.
+    int sum = 0, big = 0;
+    for (int t = 0; t < taps; t++) {
+      w[t] = (int16_t)lrint(wf[t] * WEIGHT_ONE);
+      sum += w[t];
+      if (w[t] > w[big]) big = t;
+      int p = first + t;
+      pos[t] = (p < 0) ? 0 : (p >= src) ? src - 1 : p;
+    }
+    w[big] = (int16_t)(w[big] + WEIGHT_ONE - sum);
+  }
+}
+
+bool Scaler::configure(int sw, int sh, int dw, int dh, ScaleFilter f, const RenderKernels *k) {
+  if (dw < sw || dh < sh || dw > SCALE_MAX_WIDTH || dh > SCALE_MAX_HEIGHT) {
+    fprintf(stderr, "scaler: cannot scale %dx%d to %dx%d (upscaling only, up to %dx%d)\n",
+            sw, sh, dw, dh, SCALE_MAX_WIDTH, SCALE_MAX_HEIGHT);
+    return false;
+  }
+  filt = f;
+  kernels = k;
+  srcW = sw;
+  srcH = sh;
+  dstW = dw;
+  dstH = dh;
+  taps = (f == SCALE_NEAREST) ? 1 : (f == SCALE_BILINEAR) ? 2 : 4;
+
+  cols = (ScaleTaps *)malloc(dw * sizeof(ScaleTaps));
+  rows = (ScaleTaps *)malloc(dh * sizeof(ScaleTaps));
+  mid = (f == SCALE_NEAREST) ? NULL : (int16_t *)malloc((size_t)sh * dw * 3 * sizeof(int16_t));
+  last = (uint8_t *)malloc(sw * sh * 3);
+  if (!cols || !rows || !last || (f != SCALE_NEAREST && !mid)) {
+    fprintf(stderr, "scaler: out of memory\n");
+    return false;
+  }
+  memset(cols, 0, dw * sizeof(ScaleTaps));
+  memset(rows, 0, dh * sizeof(ScaleTaps));
+  axis_taps(sw, dw, f, taps, cols);
+  axis_taps(sh, dh, f, taps, rows);
+  lastDst = NULL;
+  return true;
+}
+
+// One source row -> dstW * 3 samples, Q14 * 8 bits -> Q6.
+template <int T>
+void Scaler::filter_cols(int16_t *m, const uint8_t *src) const {
+  for (int x = 0; x < dstW; x++, m += 3) {
+    const ScaleTaps &c = cols[x];
+    for (int ch = 0; ch < 3; ch++) {
+      int32_t acc = 128;
+      for (int t = 0; t < T; t++) acc += c.w[t] * src[3 * c.pos[t] + ch];
+      m[ch] = (int16_t)(acc >> 8);
+    }
+  }
+}
+
+void Scaler::run_nearest(uint8_t *dst, const uint8_t *src) const {
+  const int line = dstW * 3;
+  for (int y = 0; y < dstH; y++, dst += line) {
+    if (y > 0 && rows[y].pos[0] == rows[y - 1].pos[0]) {
+      memcpy(dst, dst - line, line);
+      continue;
+    }
+    const uint8_t *s = src + rows[y].pos[0] * srcW * 3;
+    for (int x = 0; x < dstW; x++) memcpy(dst + 3 * x, s + 3 * cols[x].pos[0], 3);
+  }
+}
+
+void Scaler::run(uint8_t *dst, const uint8_t *src) {
+  const int n = srcW * srcH * 3;
+  if (lastDst && memcmp(src, last, n) == 0) {
+    if (dst != lastDst) memcpy(dst, lastDst, dstW * dstH * 3);
+    lastDst = dst;
+    skipped++;
+    return;
+  }
+  uint64_t t0 = scaler_now_ns();
+
+  if (filt == SCALE_NEAREST) {
+    run_nearest(dst, src);
+  } else {
+    const int line = dstW * 3;
+    for (int y = 0; y < srcH; y++) {
+      if (taps == 2) filter_cols<2>(mid + y * line, src + y * srcW * 3);
+      else filter_cols<4>(mid + y * line, src + y * srcW * 3);
+    }
+    for (int y = 0; y < dstH; y++) {
+      const int16_t *r[4];
+      for (int t = 0; t < taps; t++) r[t] = mid + rows[y].pos[t] * line;
+      kernels->filter_rows(dst + y * line, r, rows[y].w, taps, line);
+    }
+  }
+
+  memcpy(last, src, n);
+  lastDst = dst;
+  lastNs = scaler_now_ns() - t0;
+  totalNs += lastNs;
+  frames++;
+}
@@ -0,0 +1,76 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdint.h>
+
+#include "RenderKernels.h"
+
+// Resampling of the rendered image (3 bytes per pixel: RGB, or Y, U, V) to the output size
+// (--size), so consumers get e.g. 1280x720 without resizing every frame themselves.
+//
+// The filter is separable and its taps are worked out once in configure(): per output column
+// and per output row, the source positions (clamped at the edges) and Q14 weights. run()
+// filters every source row horizontally into Q6 samples, then each output row is a weighted
+// sum of 2 or 4 of those rows (RenderKernels::filter_rows, the SIMD part). Nearest just
+// copies pixels and rows.
+//
+// VoSPI repeats each unique frame about 3 times; a repeat is not resampled again.
+#define SCALE_MAX_WIDTH 3840
+#define SCALE_MAX_HEIGHT 2160
+
+enum ScaleFilter {
+  SCALE_NEAREST = 0,
+  SCALE_BILINEAR = 1,
+  SCALE_BICUBIC = 2,          // Keys, a = -0.5
+  SCALE_COUNT
+};
+
+// "nearest", "bilinear" or "bicubic". Returns false for anything else.
+bool scale_filter_parse(const char *s, ScaleFilter *f);
+const char *scale_filter_name(ScaleFilter f);
+
+// Filter taps of one output column or row.
+struct ScaleTaps {
+  int pos[4];                 // source pixel or row per tap, clamped to the image
+  int16_t w[4];               // Q14, summing to 1 << 14
+};
+
+class Scaler {
+public:
+  Scaler();
+  ~Scaler();
+
+  // Set up srcW x srcH -> dstW x dstH. Returns false (after printing why) for a size out of
+  // range or when the buffers cannot be allocated.
+  bool configure(int srcW, int srcH, int dstW, int dstH, ScaleFilter f, const RenderKernels *k);
+
+  // Resample `src` into `dst`. If `src` is the same image as on the previous call, the
+  // previous result is reused (left in place, or copied if `dst` is another buffer), so
+  // nothing else may write the last `dst` in between.
+  void run(uint8_t *dst, const uint8_t *src);
+
+  int width() const { return dstW; }
+  int height() const { return dstH; }
+  ScaleFilter filter() const { return filt; }
+
+  // Cost of run() on frames that were resampled, wall clock; repeats are counted apart.
+  uint64_t last_ns() const { return lastNs; }
+  double avg_ns() const { return frames ? (double)totalNs / frames : 0.0; }
+  uint64_t repeats() const { return skipped; }
+
+private:
+  template <int T> void filter_cols(int16_t *mid, const uint8_t *src) const;
+  void run_nearest(uint8_t *dst, const uint8_t *src) const;
+
+  ScaleFilter filt;
+  const RenderKernels *kernels;
+  int srcW, srcH, dstW, dstH, taps;
+  ScaleTaps *cols, *rows;    // per output column, per output row
+  int16_t *mid;               // srcH rows of dstW * 3 horizontally filtered samples, Q6
+  uint8_t *last;              // previous source image
+  const uint8_t *lastDst;     // and where it went; NULL = nothing kept
+
+  uint64_t lastNs, totalNs, frames, skipped;
+};
+
+#endif
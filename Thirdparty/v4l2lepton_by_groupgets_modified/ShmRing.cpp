@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ShmRing.h"
+
+// Not FUTEX_PRIVATE: the word is shared between processes.
+static long futex(std::atomic<uint32_t> *word, int op, uint32_t val, const struct timespec *timeout) {
+  return syscall(SYS_futex, (uint32_t *)word, op, val, timeout, NULL, 0);
+}
+
+static uint64_t shm_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// shm_open() wants "/name".
+static bool shm_path(const char *name, char *out, size_t n) {
+  int len = snprintf(out, n, "%s%s", (name[0] == '/') ? "" : "/", name);
+  if (len <= 1 || len >= (int)n || strchr(out + 1, '/')) {
+    fprintf(stderr, "shm ring: bad name '%s'\n", name);
+    return false;
+  }
+  return true;
+}
+
+ShmRingWriter::ShmRingWriter() : map(NULL), mapsiz(0), hdr(NULL), slots(NULL), next(0), nwakeups(0) {
+  name[0] = 0;
+}
+
+ShmRingWriter::~ShmRingWriter() {
+  close();
+}
+
+bool ShmRingWriter::create(const char *n, int nslots, uint32_t frameBytes, uint32_t width, uint32_t height,
+                           uint32_t fourcc, uint32_t bytesPerLine) {
+  if (!shm_path(n, name, sizeof(name))) return false;
+  if (nslots < 2 || nslots > SHM_RING_MAX_SLOTS) {
+    fprintf(stderr, "shm ring: %d slots, expected 2..%d\n", nslots, SHM_RING_MAX_SLOTS);
+    return false;
+  }
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t stride = (frameBytes + page - 1) / page * page;
+  mapsiz = page + nslots * stride;
+
+  shm_unlink(name);   // a ring left behind by a writer that did not exit cleanly
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) {
+    fprintf(stderr, "shm ring: cannot create %s (%s)\n", name, strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, mapsiz) < 0) {
+    fprintf(stderr, "shm ring: cannot size %s (%s)\n", name, strerror(errno));
+    ::close(fd);
+    shm_unlink(name);
+    return false;
+  }
+  void *m = mmap(NULL, mapsiz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) {
+    perror("shm ring: mmap");
+    shm_unlink(name);
+    return false;
+  }
+
+  // The object starts zeroed; magic goes in last so a reader never sees half a header.
+  map = (uint8_t *)m;
+  hdr = (ShmRingHeader *)map;
+  slots = (ShmRingSlot *)(hdr + 1);
+  hdr->version = SHM_RING_VERSION;
+  hdr->slots = nslots;
+  hdr->slot_stride = stride;
+  hdr->data_offset = page;
+  hdr->frame_bytes = frameBytes;
+  hdr->width = width;
+  hdr->height = height;
+  hdr->fourcc = fourcc;
+  hdr->bytes_per_line = bytesPerLine;
+  std::atomic_thread_fence(std::memory_order_release);
+  hdr->magic = SHM_RING_MAGIC;
+  next = 0;
+  return true;
+}
+
+void ShmRingWriter::close() {
+  if (!hdr) return;
+  hdr->closed.store(1);
+  hdr->wake.fetch_add(1);
+  futex(&hdr->wake, FUTEX_WAKE, INT_MAX, NULL);
+  munmap(map, mapsiz);
+  shm_unlink(name);
+  map = NULL;
+  hdr = NULL;
+  slots = NULL;
+}
+
+uint8_t *ShmRingWriter::begin() {
+  next = hdr->head.load(std::memory_order_relaxed) + 1;
+  const uint32_t i = (next - 1) % hdr->slots;
+  slots[i].seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return map + hdr->data_offset + (size_t)i * hdr->slot_stride;
+}
+
+void ShmRingWriter::publish(uint64_t ts_ns, uint64_t captureSeq, uint32_t frameCounter, uint16_t minV, uint16_t maxV) {
+  ShmRingSlot *s = &slots[(next - 1) % hdr->slots];
+  s->ts_ns = ts_ns;
+  s->capture_seq = captureSeq;
+  s->frame_counter = frameCounter;
+  s->min_v = minV;
+  s->max_v = maxV;
+  s->seq.store(next, std::memory_order_release);
+  hdr->head.store(next, std::memory_order_release);
+
+  // A reader bumps `waiters` before it looks at `head`, so either it sees this frame or
+  // this sees it waiting.
+  hdr->wake.fetch_add(1);
+  if (hdr->waiters.load() > 0) {
+    futex(&hdr->wake, FUTEX_WAKE, INT_MAX, NULL);
+    nwakeups++;
+  }
+}
+
+ShmRingReader::ShmRingReader() : map(NULL), mapsiz(0), hdr(NULL), slots(NULL) {}
+
+ShmRingReader::~ShmRingReader() {
+  detach();
+}
+
+bool ShmRingReader::attach(const char *n) {
+  char path[64];
+  if (!shm_path(n, path, sizeof(path))) return false;
+  int fd = shm_open(path, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "shm ring: cannot open %s (%s)\n", path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  void *m = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ShmRingHeader)) {
+    m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (m == MAP_FAILED) {
+    fprintf(stderr, "shm ring: cannot map %s\n", path);
+    return false;
+  }
+  map = (uint8_t *)m;
+  mapsiz = st.st_size;
+  hdr = (ShmRingHeader *)map;
+
+  const uint32_t magic = hdr->magic;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (magic != SHM_RING_MAGIC || hdr->version != SHM_RING_VERSION || hdr->slots < 2 ||
+      hdr->slots > SHM_RING_MAX_SLOTS || hdr->frame_bytes > hdr->slot_stride ||
+      hdr->data_offset + (uint64_t)hdr->slots * hdr->slot_stride > mapsiz) {
+    fprintf(stderr, "shm ring: %s is not a frame ring (or a different version)\n", path);
+    detach();
+    return false;
+  }
+  slots = (const ShmRingSlot *)(hdr + 1);
+  hdr->readers.fetch_add(1);
+  return true;
+}
+
+void ShmRingReader::detach() {
+  if (!map) return;
+  if (slots) hdr->readers.fetch_sub(1);
+  munmap(map, mapsiz);
+  map = NULL;
+  hdr = NULL;
+  slots = NULL;
+}
+
+uint64_t ShmRingReader::wait(uint64_t after, int timeoutMs) {
+  const uint64_t deadline = (timeoutMs < 0) ? 0 : shm_now_ns() + (uint64_t)timeoutMs * 1000000ull;
+  uint64_t seq = 0;
+  hdr->waiters.fetch_add(1);
+  for (;;) {
+    const uint32_t w = hdr->wake.load();
+    uint64_t h = hdr->head.load(std::memory_order_acquire);
+    if (h > after) {
+      seq = h;
+      break;
+    }
+    if (hdr->closed.load()) break;
+
+    struct timespec ts, *pts = NULL;
+    if (deadline) {
+      uint64_t now = shm_now_ns();
+      if (now >= deadline) break;
+      ts.tv_sec = (deadline - now) / 1000000000ull;
+      ts.tv_nsec = (deadline - now) % 1000000000ull;
+      pts = &ts;
+    }
+    // EAGAIN: `wake` moved on since it was read, look again.
+    if (futex(&hdr->wake, FUTEX_WAIT, w, pts) < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) break;
+  }
+  hdr->waiters.fetch_sub(1);
+  return seq;
+}
+
+const uint8_t *ShmRingReader::frame(uint64_t seq, ShmFrameInfo *info) const {
+  if (seq == 0 || seq > latest()) return NULL;
+  const ShmRingSlot *s = slot(seq);
+  if (s->seq.load(std::memory_order_acquire) != seq) return NULL;
+  if (info) {
+    info->seq = seq;
+    info->ts_ns = s->ts_ns;
+    info->capture_seq = s->capture_seq;
+    info->frame_counter = s->frame_counter;
+    info->min_v = s->min_v;
+    info->max_v = s->max_v;
+    if (!valid(seq)) return NULL;
+  }
+  return map + hdr->data_offset + (size_t)(s - slots) * hdr->slot_stride;
+}
+
+bool ShmRingReader::valid(uint64_t seq) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot(seq)->seq.load(std::memory_order_relaxed) == seq;
+}
@@ -0,0 +1,128 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Shared-memory frame transport (--video shm:<name>): a POSIX shared memory object
+// (/dev/shm/<name>) holding a ring of frame slots, so local readers map rendered frames
+// directly instead of going through v4l2loopback.
+//
+//   ShmRingHeader + ShmRingSlot[slots]        first page
+//   slot 0 data, slot 1 data, ...             page aligned, header.slot_stride apart
+//
+// The writer fills the slot after the newest one and publishes it by advancing `head`.
+// There are no locks: a slot's `seq` is 0 while the writer is in it, so a reader checks
+// that it did not change under it (ShmRingReader::valid) after using a frame in place. With
+// the default 8 slots a reader has about a second before a frame is overwritten at 9 Hz.
+// New frames bump the `wake` futex word; the writer only enters the kernel to wake when a
+// reader is waiting.
+#define SHM_RING_MAGIC 0x4c524e47u       // "LRNG"
+#define SHM_RING_VERSION 1
+#define SHM_RING_MAX_SLOTS 16
+#define SHM_RING_DEFAULT_SLOTS 8
+
+struct ShmRingSlot {
+  std::atomic<uint64_t> seq;     // frame number in the ring (1, 2, ...), 0 = being written
+  uint64_t ts_ns;                // CLOCK_MONOTONIC when the frame's first segment was read
+  uint64_t capture_seq;          // capture frame number
+  uint32_t frame_counter;        // Lepton telemetry frame counter, 0 without telemetry
+  uint16_t min_v, max_v;         // raw pixel range of the frame
+  uint8_t reserved[32];
+};
+
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_stride;          // bytes between slot data, a multiple of the page size
+  uint32_t data_offset;          // slot 0 data
+  uint32_t frame_bytes;
+  uint32_t width, height;
+  uint32_t fourcc;               // V4L2 pixel format, e.g. Y16 for raw counts
+  uint32_t bytes_per_line;       // of the first plane
+  std::atomic<uint64_t> head;    // newest complete frame, 0 = none yet
+  std::atomic<uint32_t> wake;    // futex word, bumped on every publish and on close
+  std::atomic<uint32_t> waiters; // readers blocked on `wake`
+  std::atomic<int32_t> readers;  // attached readers
+  std::atomic<uint32_t> closed;  // the writer has gone
+};
+
+static_assert(sizeof(ShmRingSlot) == 64, "shm ring slot layout");
+static_assert(sizeof(ShmRingHeader) == 64, "shm ring header layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shm ring needs lock-free 64-bit atomics");
+
+// Frame metadata as published with it.
+struct ShmFrameInfo {
+  uint64_t seq;
+  uint64_t ts_ns;
+  uint64_t capture_seq;
+  uint32_t frame_counter;
+  uint16_t min_v, max_v;
+};
+
+// Render thread side. Never blocks: a slow reader loses frames, it cannot hold the writer.
+class ShmRingWriter {
+public:
+  ShmRingWriter();
+  ~ShmRingWriter();
+
+  // Create /dev/shm/<name> (replacing a stale one) for frames of `frameBytes`.
+  bool create(const char *name, int slots, uint32_t frameBytes, uint32_t width, uint32_t height,
+              uint32_t fourcc, uint32_t bytesPerLine);
+  // Mark the ring closed, wake the readers and remove the name. Mapped readers keep their
+  // view until they detach.
+  void close();
+
+  // The slot to render the next frame into; it stops being readable until publish().
+  uint8_t *begin();
+  void publish(uint64_t ts_ns, uint64_t captureSeq, uint32_t frameCounter, uint16_t minV, uint16_t maxV);
+
+  int readers() const { return hdr ? hdr->readers.load(std::memory_order_relaxed) : 0; }
+  unsigned long wakeups() const { return nwakeups; }
+
+private:
+  char name[64];
+  uint8_t *map;
+  size_t mapsiz;
+  ShmRingHeader *hdr;
+  ShmRingSlot *slots;
+  uint64_t next;                 // seq of the frame being written
+  unsigned long nwakeups;
+};
+
+// Any process on the same machine; frames are used in place.
+class ShmRingReader {
+public:
+  ShmRingReader();
+  ~ShmRingReader();
+
+  bool attach(const char *name);
+  void detach();
+
+  const ShmRingHeader *header() const { return hdr; }
+
+  // Newest complete frame, 0 if none yet.
+  uint64_t latest() const { return hdr->head.load(std::memory_order_acquire); }
+
+  // Wait until a frame newer than `after` is published. Returns its number, or 0 on timeout
+  // (timeoutMs < 0: none) or once the writer has closed the ring.
+  uint64_t wait(uint64_t after, int timeoutMs);
+
+  // Frame `seq` in place and its metadata, or NULL if it has already been overwritten (or
+  // not written yet). The data may be overwritten while it is used: check valid() afterwards
+  // (or copy first).
+  const uint8_t *frame(uint64_t seq, ShmFrameInfo *info) const;
+  bool valid(uint64_t seq) const;
+
+private:
+  const ShmRingSlot *slot(uint64_t seq) const { return &slots[(seq - 1) % hdr->slots]; }
+
+  uint8_t *map;
+  size_t mapsiz;
+  ShmRingHeader *hdr;
+  const ShmRingSlot *slots;
+};
+
+#endif
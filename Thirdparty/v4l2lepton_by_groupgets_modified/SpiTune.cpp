@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "SpiTune.h"
+
+SpiClockTuner::SpiClockTuner()
+  : cur(0), prev(0), ceiling(0), isSettled(false), started(false), windowStart(0), windowErrors(0) {
+  memset(&cfg, 0, sizeof(cfg));
+}
+
+unsigned SpiClockTuner::begin(const SpiTuneConfig *c, unsigned start_hz, uint64_t now_ns) {
+  cfg = *c;
+  if (cfg.step_hz == 0) cfg.step_hz = 1000000;
+  if (cfg.max_hz < cfg.min_hz) cfg.max_hz = cfg.min_hz;
+
+  // A saved clock is trusted as is: probing above it again would cost an error burst on
+  // every start. It still steps down if the link degrades.
+  unsigned saved = load();
+  ceiling = 0;
+  isSettled = false;
+  if (saved >= cfg.min_hz && saved <= cfg.max_hz) {
+    cur = saved;
+    ceiling = saved + cfg.step_hz;
+    isSettled = true;
+    fprintf(stderr, "spi-auto: starting at the saved %.1f MHz\n", cur / 1e6);
+  } else {
+    cur = start_hz;
+    if (cur < cfg.min_hz) cur = cfg.min_hz;
+    if (cur > cfg.max_hz) cur = cfg.max_hz;
+  }
+  prev = cur;
+  started = false;
+  windowStart = now_ns;
+  return cur;
+}
+
+void SpiClockTuner::restart(uint64_t now_ns, unsigned long errors) {
+  windowStart = now_ns;
+  windowErrors = errors;
+}
+
+unsigned SpiClockTuner::update(uint64_t now_ns, unsigned long errors) {
+  // The first window starts with the first update, once the link is actually running.
+  if (!started) {
+    started = true;
+    restart(now_ns, errors);
+    return 0;
+  }
+
+  double secs = (now_ns - windowStart) * 1e-9;
+  if (secs < cfg.window_sec) return 0;
+
+  double rate = (errors - windowErrors) / secs;
+  restart(now_ns, errors);
+
+  unsigned next = cur;
+  if (rate > cfg.max_error_rate) {
+    if (ceiling == 0 || cur < ceiling) ceiling = cur;
+    isSettled = false;
+    if (cur > cfg.min_hz) {
+      next = (cur - cfg.min_hz > cfg.step_hz) ? cur - cfg.step_hz : cfg.min_hz;
+    } else if (cfg.verbose) {
+      fprintf(stderr, "spi-auto: %.1f errors/s at the minimum %.1f MHz\n", rate, cur / 1e6);
+    }
+  } else {
+    unsigned up = (cfg.max_hz - cur > cfg.step_hz) ? cur + cfg.step_hz : cfg.max_hz;
+    if (up > cur && (ceiling == 0 || up < ceiling)) next = up;
+    else if (!isSettled) settle();
+  }
+
+  if (next == cur) return 0;
+  fprintf(stderr, "spi-auto: %.1f -> %.1f MHz (%.1f errors/s)\n", cur / 1e6, next / 1e6, rate);
+  prev = cur;
+  cur = next;
+  return cur;
+}
+
+void SpiClockTuner::reject(unsigned hz) {
+  if (hz != cur) return;
+  fprintf(stderr, "spi-auto: cannot switch to %.1f MHz, staying at %.1f MHz\n", hz / 1e6, prev / 1e6);
+  ceiling = hz;
+  cur = prev;
+}
+
+void SpiClockTuner::settle() {
+  isSettled = true;
+  fprintf(stderr, "spi-auto: settled at %.1f MHz\n", cur / 1e6);
+  store();
+}
+
+unsigned SpiClockTuner::load() const {
+  if (!cfg.state_path) return 0;
+  FILE *f = fopen(cfg.state_path, "r");
+  if (!f) return 0;
+  unsigned hz = 0;
+  if (fscanf(f, "%u", &hz) != 1) hz = 0;
+  fclose(f);
+  return hz;
+}
+
+// Written to a temporary file and renamed over the old one, so a crash or power cut
+// leaves either the previous clock or the new one, never a torn file.
+void SpiClockTuner::store() const {
+  if (!cfg.state_path) return;
+  size_t len = strlen(cfg.state_path) + 5;
+  char *tmp = (char *)malloc(len);
+  if (!tmp) return;
+  snprintf(tmp, len, "%s.tmp", cfg.state_path);
+
+  FILE *f = fopen(tmp, "w");
+  if (!f) {
+    fprintf(stderr, "spi-auto: cannot write %s (%s)\n", tmp, strerror(errno));
+    free(tmp);
+    return;
+  }
+  bool ok = fprintf(f, "%u\n", cur) > 0;
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp, cfg.state_path) != 0) {
+    fprintf(stderr, "spi-auto: cannot save clock to %s (%s)\n", cfg.state_path, strerror(errno));
+    remove(tmp);
+  }
+  free(tmp);
+}
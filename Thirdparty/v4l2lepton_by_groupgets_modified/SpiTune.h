@@ -0,0 +1,60 @@
+#ifndef SPITUNE_H
+#define SPITUNE_H
+
+#include <stdint.h>
+
+// Adaptive SPI clock (--spi-auto).
+//
+// The capture thread feeds the tuner a running count of link errors (CRC failures, segments
+// that broke off mid-way, corrupt segment numbers). Every measurement window the error rate
+// decides the next step: below the threshold the clock goes up one step, above it the clock
+// goes down one step and that clock is remembered as too fast. Once the next step up would
+// hit a clock already known to be too fast (or the top of the range), the tuner has settled
+// and writes the clock to the state file; the next start begins there without probing
+// upwards again (delete the file to re-tune from scratch).
+//
+// A settled link that starts failing (warmer board, moved cable) steps down again and the
+// new clock is persisted in turn.
+
+struct SpiTuneConfig {
+  unsigned min_hz, max_hz, step_hz;
+  double max_error_rate;        // errors per second tolerated at the chosen clock
+  double window_sec;            // measurement window per step
+  const char *state_path;       // where the settled clock is kept (NULL = not persisted)
+  int verbose;
+};
+
+class SpiClockTuner {
+public:
+  SpiClockTuner();
+
+  // Returns the clock to start at: the persisted one if it lies in range, else `start_hz`
+  // clamped to the range.
+  unsigned begin(const SpiTuneConfig *cfg, unsigned start_hz, uint64_t now_ns);
+
+  // `errors` is a cumulative count. Returns the clock to switch to, or 0 to keep the current one.
+  unsigned update(uint64_t now_ns, unsigned long errors);
+
+  // The clock update() asked for could not be applied; stay where we were.
+  void reject(unsigned hz);
+
+  unsigned clock() const { return cur; }
+  bool settled() const { return isSettled; }
+
+private:
+  void restart(uint64_t now_ns, unsigned long errors);
+  void settle();
+  unsigned load() const;
+  void store() const;
+
+  SpiTuneConfig cfg;
+  unsigned cur;
+  unsigned prev;
+  unsigned ceiling;             // lowest clock seen failing, 0 = none yet
+  bool isSettled;
+  bool started;
+  uint64_t windowStart;
+  unsigned long windowErrors;
+};
+
+#endif
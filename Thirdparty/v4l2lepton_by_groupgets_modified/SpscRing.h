@@ -0,0 +1,44 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Lock-free single-producer/single-consumer ring of N fixed slots (N must be a power of two).
+// Slots are filled and drained in place: the producer claim()s a slot, writes it and
+// publish()es it; the consumer reads front() and release()s it. Neither side ever blocks,
+// so a full ring is the producer's problem (it should drop, not wait).
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+  SpscRing() : head(0), tail(0) {}
+
+  // Producer side. Returns NULL when the ring is full.
+  T *claim() {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) return NULL;
+    return &slots[h & (N - 1)];
+  }
+  void publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer side. Returns NULL when the ring is empty.
+  T *front() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t) return NULL;
+    return &slots[t & (N - 1)];
+  }
+  void release() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  void reset() { head.store(0); tail.store(0); }
+
+private:
+  // Keep the two indices on separate cache lines so producer and consumer do not false-share.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) T slots[N];
+};
+
+#endif
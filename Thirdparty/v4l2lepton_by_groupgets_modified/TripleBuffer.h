@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Latest-frame-wins exchange of three buffers between one producer and one consumer. The
+// producer fills the back buffer and publish()es it, swapping it with the middle one; the
+// consumer take()s the middle buffer as its front one when a new frame is there. Neither
+// side ever blocks or waits for the other: a frame the consumer has not taken by the next
+// publish() is replaced, and the consumer always gets the newest complete frame.
+//
+// Only buffer indices (0..2) are exchanged; the caller owns the buffers.
+class TripleBuffer {
+public:
+  TripleBuffer() : back(0), front(1), state(2) {}
+
+  // Producer side: the buffer to fill next.
+  int back_index() const { return back; }
+
+  // Producer side: hand the filled back buffer over. Returns false if the frame published
+  // before it was never taken.
+  bool publish() {
+    unsigned old = state.exchange((unsigned)back | FRESH, std::memory_order_acq_rel);
+    back = (int)(old & INDEX);
+    return !(old & FRESH);
+  }
+
+  // Producer side: a published frame has not been taken yet (the next publish() would
+  // replace it).
+  bool pending() const { return (state.load(std::memory_order_acquire) & FRESH) != 0; }
+
+  // Consumer side: the newest published buffer, or -1 if nothing was published since the
+  // last take(). The buffer stays the consumer's until the next successful take().
+  int take() {
+    if (!(state.load(std::memory_order_acquire) & FRESH)) return -1;
+    unsigned old = state.exchange((unsigned)front, std::memory_order_acq_rel);
+    front = (int)(old & INDEX);
+    return front;
+  }
+
+private:
+  enum { INDEX = 3, FRESH = 4 };
+
+  alignas(64) int back;                  // producer only
+  alignas(64) int front;                 // consumer only
+  alignas(64) std::atomic<unsigned> state;   // middle buffer index | FRESH
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "V4l2Stream.h"
+
+V4l2Stream::V4l2Stream() : fd(-1), size(0), count(0), unused(0), current(-1) {
+  for (int i = 0; i < V4L2_STREAM_MAX_BUFFERS; i++) maps[i] = MAP_FAILED;
+}
+
+V4l2Stream::~V4l2Stream() {
+  stop();
+}
+
+bool V4l2Stream::start(int vfd, int bytes, int want) {
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.count = (want > V4L2_STREAM_MAX_BUFFERS) ? V4L2_STREAM_MAX_BUFFERS : want;
+  req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(vfd, VIDIOC_REQBUFS, &req) < 0) {
+    fprintf(stderr, "v4l2 stream: VIDIOC_REQBUFS: %s\n", strerror(errno));
+    return false;
+  }
+  fd = vfd;
+  size = bytes;
+  count = ((int)req.count > V4L2_STREAM_MAX_BUFFERS) ? V4L2_STREAM_MAX_BUFFERS : (int)req.count;
+  if (count < 2) {
+    fprintf(stderr, "v4l2 stream: the driver gave %d buffers\n", count);
+    stop();
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    struct v4l2_buffer b;
+    memset(&b, 0, sizeof(b));
+    b.index = i;
+    b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    b.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(fd, VIDIOC_QUERYBUF, &b) < 0 || (int)b.length < size) {
+      fprintf(stderr, "v4l2 stream: buffer %d unusable\n", i);
+      stop();
+      return false;
+    }
+    lengths[i] = b.length;
+    maps[i] = mmap(NULL, b.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, b.m.offset);
+    if (maps[i] == MAP_FAILED) {
+      perror("v4l2 stream: mmap");
+      stop();
+      return false;
+    }
+  }
+
+  int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  if (ioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+    perror("v4l2 stream: VIDIOC_STREAMON");
+    stop();
+    return false;
+  }
+  unused = 0;
+  current = -1;
+  return true;
+}
+
+void V4l2Stream::stop() {
+  if (fd < 0) return;
+  int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  ioctl(fd, VIDIOC_STREAMOFF, &type);
+  for (int i = 0; i < V4L2_STREAM_MAX_BUFFERS; i++) {
+    if (maps[i] != MAP_FAILED) munmap(maps[i], lengths[i]);
+    maps[i] = MAP_FAILED;
+  }
+  struct v4l2_requestbuffers req;
+  memset(&req, 0, sizeof(req));
+  req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  req.memory = V4L2_MEMORY_MMAP;
+  ioctl(fd, VIDIOC_REQBUFS, &req);
+  fd = -1;
+  count = 0;
+}
+
+uint8_t *V4l2Stream::acquire() {
+  if (current >= 0) return (uint8_t *)maps[current];
+  if (unused < count) {
+    current = unused++;
+    return (uint8_t *)maps[current];
+  }
+
+  // POLLOUT: a queued buffer is done and can be dequeued without blocking.
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLOUT;
+  if (poll(&p, 1, 0) != 1 || !(p.revents & POLLOUT)) return NULL;
+
+  struct v4l2_buffer b;
+  memset(&b, 0, sizeof(b));
+  b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  b.memory = V4L2_MEMORY_MMAP;
+  if (ioctl(fd, VIDIOC_DQBUF, &b) < 0 || (int)b.index >= count) return NULL;
+  current = b.index;
+  return (uint8_t *)maps[current];
+}
+
+bool V4l2Stream::queue(uint64_t ts_ns, uint32_t sequence) {
+  struct v4l2_buffer b;
+  memset(&b, 0, sizeof(b));
+  b.index = current;
+  b.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  b.memory = V4L2_MEMORY_MMAP;
+  b.bytesused = size;
+  b.field = V4L2_FIELD_NONE;
+  b.timestamp.tv_sec = ts_ns / 1000000000ull;
+  b.timestamp.tv_usec = (ts_ns % 1000000000ull) / 1000;
+  b.sequence = sequence;
+  if (ioctl(fd, VIDIOC_QBUF, &b) < 0) return false;
+  current = -1;
+  return true;
+}
@@ -0,0 +1,45 @@
+#ifndef V4L2STREAM_H
+#define V4L2STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming I/O on a V4L2 output device (--io mmap): the driver's buffers are mapped once
+// and the renderer draws straight into one, then queues it with the frame's capture time and
+// sequence number, instead of a write() that copies the frame into the kernel and leaves
+// the driver to stamp it on arrival. v4l2loopback passes a queued buffer's timestamp and
+// sequence on to its readers.
+//
+// Nothing here blocks: acquire() only takes a buffer the driver is done with, so a driver
+// that holds all of them costs a dropped frame rather than a stalled render thread.
+#define V4L2_STREAM_MAX_BUFFERS 8
+
+class V4l2Stream {
+public:
+  V4l2Stream();
+  ~V4l2Stream();
+
+  // Request and map up to `count` buffers of `size` bytes on output device `fd` (its format
+  // already set) and start streaming. Returns false, with nothing left set up, if the driver
+  // cannot stream.
+  bool start(int fd, int size, int count);
+  void stop();
+
+  // A buffer to render into, or NULL if every buffer is still with the driver.
+  uint8_t *acquire();
+
+  // Queue the acquired buffer, stamped with `ts_ns` (CLOCK_MONOTONIC) and `sequence`.
+  // Returns false if the driver refuses it (the buffer is then free again).
+  bool queue(uint64_t ts_ns, uint32_t sequence);
+
+  int buffers() const { return count; }
+
+private:
+  int fd, size, count;
+  void *maps[V4L2_STREAM_MAX_BUFFERS];
+  size_t lengths[V4L2_STREAM_MAX_BUFFERS];
+  int unused;                 // buffers never queued yet, handed out first
+  int current;                // acquired buffer, -1 = none
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include <string.h>
+
+#include "VoSPI.h"
+#include "leptonSDKEmb32PUB/crc16.h"
+
+extern "C" const CRC16 ccitt_16Table[];
+
+// Slice-by-8 CRC-16/CCITT (x^16 + x^12 + x^5 + 1, MSB first, seed 0).
+// crc_tab[0] is the SDK's byte table; crc_tab[k][x] is the CRC of byte x followed by k zero
+// bytes, so eight input bytes fold into the register with eight independent lookups.
+static uint16_t crc_tab[8][256];
+
+static struct CrcTablesInit {
+  CrcTablesInit() {
+    for (int x = 0; x < 256; x++) crc_tab[0][x] = ccitt_16Table[x];
+    for (int k = 1; k < 8; k++) {
+      for (int x = 0; x < 256; x++) {
+        uint16_t prev = crc_tab[k - 1][x];
+        crc_tab[k][x] = (uint16_t)((prev << 8) ^ crc_tab[0][prev >> 8]);
+      }
+    }
+  }
+} crc_tables_init;
+
+static inline uint16_t crc_bytes(uint16_t crc, const uint8_t *p, size_t len) {
+  while (len >= 8) {
+    crc = crc_tab[7][p[0] ^ (crc >> 8)] ^ crc_tab[6][p[1] ^ (crc & 0xFF)] ^
+          crc_tab[5][p[2]] ^ crc_tab[4][p[3]] ^
+          crc_tab[3][p[4]] ^ crc_tab[2][p[5]] ^
+          crc_tab[1][p[6]] ^ crc_tab[0][p[7]];
+    p += 8;
+    len -= 8;
+  }
+  while (len--) {
+    crc = (uint16_t)((crc << 8) ^ crc_tab[0][(crc >> 8) ^ *p++]);
+  }
+  return crc;
+}
+
+uint16_t vospi_crc(const uint8_t *pkt) {
+  // The CRC covers the whole packet with the T nibble of the ID and the CRC field zeroed.
+  uint8_t head[8];
+  memcpy(head, pkt, sizeof(head));
+  head[0] &= 0x0F;
+  head[2] = 0;
+  head[3] = 0;
+
+  uint16_t crc = crc_bytes(0, head, sizeof(head));
+  return crc_bytes(crc, pkt + sizeof(head), PACKET_SIZE - sizeof(head));
+}
@@ -0,0 +1,97 @@
+#ifndef VOSPI_H
+#define VOSPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACKET_SIZE 164
+#define PACKET_SIZE_UINT16 (PACKET_SIZE/2)       // 82
+#define PACKETS_PER_FRAME 60                     // payload packets per segment/frame (telemetry-disabled base)
+#define FRAME_SIZE_UINT16 (PACKET_SIZE_UINT16*PACKETS_PER_FRAME)
+
+// Telemetry rows, when enabled on the camera, add packets to every frame:
+// Lepton 2 sends 63 packets instead of 60, Lepton 3 sends 61 per segment (244 per frame).
+// In header mode they come first in the frame, in footer mode last; image rows shift accordingly.
+enum TelemetryMode { TELEMETRY_OFF = 0, TELEMETRY_HEADER = 1, TELEMETRY_FOOTER = 2 };
+
+// Telemetry row A word offsets (Lepton engineering datasheet, "Telemetry Data Content").
+// 32-bit fields are sent as two words, least significant word first.
+#define TELEMETRY_PACKETS_L2 3                   // rows A, B, C as packets 60..62
+#define TELEMETRY_PACKETS_L3 4                   // rows A, B, C (+ reserved) as the last 4 of 244
+#define TELEMETRY_A_REVISION 0
+#define TELEMETRY_A_TIME_MS 1                    // uptime in ms (32-bit)
+#define TELEMETRY_A_STATUS 3                     // status bits (32-bit)
+#define TELEMETRY_A_FRAME_COUNTER 20             // 32-bit
+#define TELEMETRY_A_FRAME_MEAN 22
+#define TELEMETRY_A_FPA_TEMP_COUNTS 23
+#define TELEMETRY_A_FPA_TEMP_K100 24             // FPA temperature, Kelvin x 100
+#define TELEMETRY_A_FFC_FPA_TEMP_K100 29         // FPA temperature at last FFC, Kelvin x 100
+#define TELEMETRY_A_FFC_TIME_MS 30               // uptime at last FFC in ms (32-bit)
+
+#define TELEMETRY_STATUS_FFC_DESIRED (1u << 3)
+#define TELEMETRY_STATUS_FFC_STATE_SHIFT 4       // 2 bits: 0 never, 1 imminent, 2 in progress, 3 done
+#define TELEMETRY_STATUS_FFC_STATE_MASK (3u << TELEMETRY_STATUS_FFC_STATE_SHIFT)
+
+// Decoded telemetry row A.
+struct Telemetry {
+  bool valid;
+  uint32_t frame_counter;      // increments once per unique frame
+  uint32_t time_ms;            // camera uptime
+  uint32_t status;
+  uint16_t frame_mean;
+  uint16_t fpa_temp_k100;
+  uint16_t ffc_fpa_temp_k100;
+  uint32_t ffc_time_ms;
+};
+
+static inline int telemetry_packets(int typeLepton) {
+  return (typeLepton == 3) ? TELEMETRY_PACKETS_L3 : TELEMETRY_PACKETS_L2;
+}
+
+static inline uint16_t telemetry_word(const uint8_t *payload, int word) {
+  return (uint16_t)((payload[2 * word] << 8) | payload[2 * word + 1]);
+}
+
+static inline uint32_t telemetry_dword(const uint8_t *payload, int word) {
+  return (uint32_t)telemetry_word(payload, word) | ((uint32_t)telemetry_word(payload, word + 1) << 16);
+}
+
+// `pkt` is the whole 164-byte packet carrying telemetry row A.
+static inline void parse_telemetry_row_a(const uint8_t *pkt, Telemetry *t) {
+  const uint8_t *payload = pkt + 4;
+  t->valid = true;
+  t->frame_counter = telemetry_dword(payload, TELEMETRY_A_FRAME_COUNTER);
+  t->time_ms = telemetry_dword(payload, TELEMETRY_A_TIME_MS);
+  t->status = telemetry_dword(payload, TELEMETRY_A_STATUS);
+  t->frame_mean = telemetry_word(payload, TELEMETRY_A_FRAME_MEAN);
+  t->fpa_temp_k100 = telemetry_word(payload, TELEMETRY_A_FPA_TEMP_K100);
+  t->ffc_fpa_temp_k100 = telemetry_word(payload, TELEMETRY_A_FFC_FPA_TEMP_K100);
+  t->ffc_time_ms = telemetry_dword(payload, TELEMETRY_A_FFC_TIME_MS);
+}
+
+static inline int telemetry_ffc_state(const Telemetry *t) {
+  return (int)((t->status & TELEMETRY_STATUS_FFC_STATE_MASK) >> TELEMETRY_STATUS_FFC_STATE_SHIFT);
+}
+
+// CRC-16/CCITT of a VoSPI packet as the camera computes it (bytes 2-3 of the header).
+uint16_t vospi_crc(const uint8_t *pkt);
+
+static inline bool vospi_crc_ok(const uint8_t *pkt) {
+  return vospi_crc(pkt) == (uint16_t)((pkt[2] << 8) | pkt[3]);
+}
+
+// Host resynchronisation: with CS deasserted and SCK idle for at least 5 frame periods
+// (> 185 ms) the camera abandons the frame in progress and restarts at a frame boundary.
+#define VOSPI_RESYNC_IDLE_US 200000
+
+// discard packet pattern (xFxx)
+static inline bool is_discard_packet(const uint8_t *pkt) {
+  return ((pkt[0] & 0x0F) == 0x0F);
+}
+
+// Lepton 3 segment number (TTT bits), only meaningful in packet 20 of a segment.
+static inline int packet_segment_number(const uint8_t *pkt) {
+  return (pkt[0] >> 4) & 0x0F;
+}
+
+#endif
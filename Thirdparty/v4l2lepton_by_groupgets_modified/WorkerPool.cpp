@@ -0,0 +1,87 @@
+#include <stdio.h>
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool()
+  : nthreads(1), generation(0), busy(0), stopping(false), fn(NULL), arg(NULL), tasks(0), next(0) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&go, NULL);
+  pthread_cond_init(&done, NULL);
+}
+
+WorkerPool::~WorkerPool() {
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&go);
+  pthread_mutex_unlock(&lock);
+  for (int i = 1; i < nthreads; i++) pthread_join(helpers[i], NULL);
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&go);
+  pthread_mutex_destroy(&lock);
+}
+
+bool WorkerPool::start(int threads) {
+  if (threads > WORKER_POOL_MAX) threads = WORKER_POOL_MAX;
+  for (int i = nthreads; i < threads; i++) {
+    if (pthread_create(&helpers[i], NULL, worker_main, this)) {
+      fprintf(stderr, "worker pool: pthread_create failed, %d threads\n", nthreads);
+      return nthreads > 1;
+    }
+    nthreads = i + 1;
+  }
+  return true;
+}
+
+void *WorkerPool::worker_main(void *self) {
+  ((WorkerPool *)self)->work_loop();
+  return NULL;
+}
+
+void WorkerPool::take_tasks() {
+  for (;;) {
+    int t = next.fetch_add(1);
+    if (t >= tasks) break;
+    fn(arg, t);
+  }
+}
+
+void WorkerPool::work_loop() {
+  unsigned seen = 0;
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (generation == seen && !stopping) pthread_cond_wait(&go, &lock);
+    if (stopping) break;
+    seen = generation;
+    pthread_mutex_unlock(&lock);
+
+    take_tasks();
+
+    pthread_mutex_lock(&lock);
+    if (--busy == 0) pthread_cond_signal(&done);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void WorkerPool::run(int ntasks, void (*f)(void *arg, int task), void *a) {
+  if (nthreads == 1 || ntasks <= 1) {
+    for (int t = 0; t < ntasks; t++) f(a, t);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  fn = f;
+  arg = a;
+  tasks = ntasks;
+  next = 0;
+  busy = nthreads - 1;
+  generation++;
+  pthread_cond_broadcast(&go);
+  pthread_mutex_unlock(&lock);
+
+  take_tasks();
+
+  pthread_mutex_lock(&lock);
+  while (busy > 0) pthread_cond_wait(&done, &lock);
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,43 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <pthread.h>
+#include <atomic>
+
+#define WORKER_POOL_MAX 8
+
+// A few long-lived threads for splitting one frame's work into independent tasks. The
+// calling thread works too, so a pool of 1 runs everything inline and starts no threads.
+class WorkerPool {
+public:
+  WorkerPool();
+  ~WorkerPool();
+
+  // `threads` includes the caller; capped at WORKER_POOL_MAX. Returns false if no helper
+  // thread could be started (the pool then runs inline).
+  bool start(int threads);
+  int size() const { return nthreads; }
+
+  // Run fn(arg, 0 .. tasks-1), spread over the pool, and return when all are done.
+  void run(int tasks, void (*fn)(void *arg, int task), void *arg);
+
+private:
+  static void *worker_main(void *self);
+  void work_loop();
+  void take_tasks();
+
+  int nthreads;                         // including the caller
+  pthread_t helpers[WORKER_POOL_MAX];   // 1 .. nthreads-1; slot 0 is the caller
+  pthread_mutex_t lock;
+  pthread_cond_t go, done;
+  unsigned generation;                  // bumped for every run()
+  int busy;                             // helpers still working on this generation
+  bool stopping;
+
+  void (*fn)(void *arg, int task);
+  void *arg;
+  int tasks;
+  std::atomic<int> next;                // next task to hand out
+};
+
+#endif
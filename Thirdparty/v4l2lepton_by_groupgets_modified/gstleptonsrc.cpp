@@ -0,0 +1,435 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+
+#include "gstleptonsrc.h"
+#include "Palettes.h"
+#include "Capture.h"
+#include "FrameCapture.h"
+#include "RenderKernels.h"
+#include "Render.h"
+
+GST_DEBUG_CATEGORY_STATIC(lepton_src_debug);
+#define GST_CAT_DEFAULT lepton_src_debug
+
+// A frame goes downstream once its last segment is in, up to one frame period (9 Hz) after
+// the time it is stamped with.
+#define LEPTON_LATENCY (GST_SECOND / 9)
+
+#define LEPTON_FORMATS "{ RGB, GRAY16_LE, GRAY8, YUY2, NV12, I420 }"
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
+  "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+  GST_STATIC_CAPS("video/x-raw, format = (string) " LEPTON_FORMATS ", "
+                  "width = (int) 160, height = (int) 120, framerate = (fraction) 0/1; "
+                  "video/x-raw, format = (string) " LEPTON_FORMATS ", "
+                  "width = (int) 80, height = (int) 60, framerate = (fraction) 0/1"));
+
+static const struct {
+  GstVideoFormat video;
+  OutFmt out;
+} formats[] = {
+  { GST_VIDEO_FORMAT_RGB, OUT_RGB24 },
+  { GST_VIDEO_FORMAT_GRAY16_LE, OUT_Y16 },
+  { GST_VIDEO_FORMAT_GRAY8, OUT_GREY },
+  { GST_VIDEO_FORMAT_YUY2, OUT_YUYV },
+  { GST_VIDEO_FORMAT_NV12, OUT_NV12 },
+  { GST_VIDEO_FORMAT_I420, OUT_I420 },
+};
+
+enum {
+  PROP_0,
+  PROP_DEVICE,
+  PROP_SOURCE,
+  PROP_TYPE,
+  PROP_TELEMETRY,
+  PROP_COLORMAP,
+  PROP_AGC,
+  PROP_SPI_MHZ,
+  PROP_BATCH,
+  PROP_CHECK_CRC,
+};
+
+struct _GstLeptonSrc {
+  GstPushSrc parent;
+
+  // Properties, read at start().
+  gchar *device;                // spidev node, NULL = the SPI.cpp default
+  gchar *source_spec;           // capture_create() spec, NULL = spidev
+  gint type;                    // 2 or 3
+  gchar *telemetry;             // off, header or footer
+  gint colormap;
+  gchar *agc;                   // linear, clip, heq or clahe
+  gint spi_mhz;
+  gint batch;
+  gboolean check_crc;
+
+  // start() to stop().
+  CaptureSource *source;
+  FrameCapture *capture;
+  TelemetryMode telemetryMode;
+  AgcConfig agcCfg;
+  AgcEngine *agcEngine;
+  ClaheEngine *clahe;
+  const RenderKernels *kernels;
+  uint8_t *stage;
+  Y16RgbLut *y16Lut;            // heq only
+
+  // Negotiated.
+  OutFmt fmt;
+  const RenderPath *path;
+  RenderContext ctx;
+  gboolean capturing;           // capture thread running
+  gint flushing;
+};
+
+G_DEFINE_TYPE(GstLeptonSrc, gst_lepton_src, GST_TYPE_PUSH_SRC);
+
+static void gst_lepton_src_init(GstLeptonSrc *src) {
+  src->type = 2;
+  src->telemetry = g_strdup("off");
+  src->colormap = 3;
+  src->agc = g_strdup("linear");
+  src->batch = 1;
+  src->check_crc = TRUE;
+  gst_base_src_set_live(GST_BASE_SRC(src), TRUE);
+  gst_base_src_set_format(GST_BASE_SRC(src), GST_FORMAT_TIME);
+  gst_base_src_set_do_timestamp(GST_BASE_SRC(src), FALSE);
+}
+
+static void gst_lepton_src_finalize(GObject *object) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(object);
+  g_free(src->device);
+  g_free(src->source_spec);
+  g_free(src->telemetry);
+  g_free(src->agc);
+  G_OBJECT_CLASS(gst_lepton_src_parent_class)->finalize(object);
+}
+
+static void gst_lepton_src_set_property(GObject *object, guint id, const GValue *value, GParamSpec *pspec) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(object);
+  GST_OBJECT_LOCK(src);
+  switch (id) {
+    case PROP_DEVICE: g_free(src->device); src->device = g_value_dup_string(value); break;
+    case PROP_SOURCE: g_free(src->source_spec); src->source_spec = g_value_dup_string(value); break;
+    case PROP_TYPE: src->type = g_value_get_int(value); break;
+    case PROP_TELEMETRY: g_free(src->telemetry); src->telemetry = g_value_dup_string(value); break;
+    case PROP_COLORMAP: src->colormap = g_value_get_int(value); break;
+    case PROP_AGC: g_free(src->agc); src->agc = g_value_dup_string(value); break;
+    case PROP_SPI_MHZ: src->spi_mhz = g_value_get_int(value); break;
+    case PROP_BATCH: src->batch = g_value_get_int(value); break;
+    case PROP_CHECK_CRC: src->check_crc = g_value_get_boolean(value); break;
+    default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec); break;
+  }
+  GST_OBJECT_UNLOCK(src);
+}
+
+static void gst_lepton_src_get_property(GObject *object, guint id, GValue *value, GParamSpec *pspec) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(object);
+  GST_OBJECT_LOCK(src);
+  switch (id) {
+    case PROP_DEVICE: g_value_set_string(value, src->device); break;
+    case PROP_SOURCE: g_value_set_string(value, src->source_spec); break;
+    case PROP_TYPE: g_value_set_int(value, src->type); break;
+    case PROP_TELEMETRY: g_value_set_string(value, src->telemetry); break;
+    case PROP_COLORMAP: g_value_set_int(value, src->colormap); break;
+    case PROP_AGC: g_value_set_string(value, src->agc); break;
+    case PROP_SPI_MHZ: g_value_set_int(value, src->spi_mhz); break;
+    case PROP_BATCH: g_value_set_int(value, src->batch); break;
+    case PROP_CHECK_CRC: g_value_set_boolean(value, src->check_crc); break;
+    default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, id, pspec); break;
+  }
+  GST_OBJECT_UNLOCK(src);
+}
+
+static gboolean gst_lepton_src_stop(GstBaseSrc *bsrc);
+
+static gboolean gst_lepton_src_start(GstBaseSrc *bsrc) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(bsrc);
+
+  if (strcmp(src->telemetry, "header") == 0) src->telemetryMode = TELEMETRY_HEADER;
+  else if (strcmp(src->telemetry, "footer") == 0) src->telemetryMode = TELEMETRY_FOOTER;
+  else if (strcmp(src->telemetry, "off") == 0) src->telemetryMode = TELEMETRY_OFF;
+  else {
+    GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("telemetry expects off, header or footer"), (NULL));
+    return FALSE;
+  }
+  src->agcCfg = AgcConfig();
+  if (!agc_mode_parse(src->agc, &src->agcCfg.mode)) {
+    GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("agc expects linear, clip, heq or clahe"), (NULL));
+    return FALSE;
+  }
+  src->kernels = render_kernels_select("auto");
+
+  CaptureConfig cc;
+  cc.typeLepton = src->type;
+  cc.spidev = src->device;
+  cc.spi_mhz = src->spi_mhz;
+  cc.batch = src->batch;
+  cc.verbose = 0;
+  src->source = capture_create(src->source_spec, &cc);
+  if (!src->source) {
+    GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("bad source '%s'", src->source_spec), (NULL));
+    return FALSE;
+  }
+
+  src->capture = new FrameCapture();
+  src->agcEngine = new AgcEngine();
+  src->agcEngine->configure(src->agcCfg);
+  if (src->agcCfg.mode == AGC_CLAHE) {
+    src->clahe = new ClaheEngine();
+    if (!src->clahe->configure(ClaheConfig(), (src->type == 3) ? 160 : 80, (src->type == 3) ? 120 : 60)) {
+      GST_ELEMENT_ERROR(src, RESOURCE, SETTINGS, ("clahe setup failed"), (NULL));
+      gst_lepton_src_stop(bsrc);
+      return FALSE;
+    }
+  }
+  src->stage = (uint8_t *)g_malloc(MAX_WIDTH * MAX_HEIGHT * 3);
+  if (src->agcCfg.mode == AGC_HEQ) src->y16Lut = (Y16RgbLut *)g_malloc0(sizeof(Y16RgbLut));
+  src->path = NULL;
+  src->capturing = FALSE;
+  g_atomic_int_set(&src->flushing, 0);
+  return TRUE;
+}
+
+static gboolean gst_lepton_src_stop(GstBaseSrc *bsrc) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(bsrc);
+  if (src->capturing) src->capture->stop();
+  src->capturing = FALSE;
+  delete src->capture;
+  delete src->source;
+  delete src->agcEngine;
+  delete src->clahe;
+  g_free(src->stage);
+  g_free(src->y16Lut);
+  src->capture = NULL;
+  src->source = NULL;
+  src->agcEngine = NULL;
+  src->clahe = NULL;
+  src->stage = NULL;
+  src->y16Lut = NULL;
+  return TRUE;
+}
+
+// The template's caps for this sensor's size.
+static GstCaps *gst_lepton_src_get_caps(GstBaseSrc *bsrc, GstCaps *filter) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(bsrc);
+  GstCaps *caps = gst_caps_make_writable(gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(bsrc)));
+  const int width = (src->type == 3) ? 160 : 80;
+  for (int i = (int)gst_caps_get_size(caps) - 1; i >= 0; i--) {
+    int w = 0;
+    gst_structure_get_int(gst_caps_get_structure(caps, i), "width", &w);
+    if (w != width) gst_caps_remove_structure(caps, i);
+  }
+  if (filter) {
+    GstCaps *both = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref(caps);
+    caps = both;
+  }
+  return caps;
+}
+
+// Pick the render path for the negotiated format and (re)start capture with it: the path
+// also decodes, and decoding gathers what its AGC mode needs.
+static gboolean gst_lepton_src_set_caps(GstBaseSrc *bsrc, GstCaps *caps) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(bsrc);
+  GstVideoInfo info;
+  if (!gst_video_info_from_caps(&info, caps)) return FALSE;
+
+  size_t i = 0;
+  while (i < G_N_ELEMENTS(formats) && formats[i].video != GST_VIDEO_INFO_FORMAT(&info)) i++;
+  if (i == G_N_ELEMENTS(formats)) return FALSE;
+  const OutFmt fmt = formats[i].out;
+  const RenderPath *path = render_path_select(src->type, fmt, src->agcCfg.mode);
+  if (!path || (int)GST_VIDEO_INFO_SIZE(&info) != path->frameBytes) {
+    GST_ERROR_OBJECT(src, "no render path for %" GST_PTR_FORMAT, caps);
+    return FALSE;
+  }
+
+  if (src->capturing) src->capture->stop();
+  src->capturing = FALSE;
+  src->fmt = fmt;
+  src->path = path;
+
+  RenderContext *ctx = &src->ctx;
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->kernels = src->kernels;
+  ctx->palette = (fmt == OUT_RGB24) ? palette_rgbx(src->colormap) : palette_yuvx(src->colormap, fmt == OUT_GREY);
+  ctx->stage = src->stage;
+  ctx->y16Lut = (fmt != OUT_Y16) ? src->y16Lut : NULL;
+
+  FrameCaptureConfig fc;
+  memset(&fc, 0, sizeof(fc));
+  fc.typeLepton = src->type;
+  fc.telemetry = src->telemetryMode;
+  fc.checkCrc = src->check_crc;
+  fc.keepHist = fmt != OUT_Y16 && (src->agcCfg.mode == AGC_CLIP || src->agcCfg.mode == AGC_HEQ);
+  fc.path = path;
+  fc.kernels = src->kernels;
+  fc.cpu = -1;
+  src->capture->configure(src->source, fc);
+
+  src->agcEngine->reset();
+  if (!src->capture->start()) {
+    GST_ELEMENT_ERROR(src, RESOURCE, OPEN_READ, ("cannot open %s", src->source->name()), (NULL));
+    return FALSE;
+  }
+  src->capturing = TRUE;
+  GST_INFO_OBJECT(src, "render path %s", path->name);
+  return TRUE;
+}
+
+// Frames are written tightly packed, the default video layout for these sizes, so buffers
+// always come from our own pool whatever downstream offers.
+static gboolean gst_lepton_src_decide_allocation(GstBaseSrc *bsrc, GstQuery *query) {
+  GstCaps *caps;
+  GstVideoInfo info;
+  gst_query_parse_allocation(query, &caps, NULL);
+  if (!caps || !gst_video_info_from_caps(&info, caps)) return FALSE;
+
+  guint size = GST_VIDEO_INFO_SIZE(&info), min = 2, max = 0;
+  const gboolean update = gst_query_get_n_allocation_pools(query) > 0;
+  if (update) {
+    GstBufferPool *theirs = NULL;
+    guint theirSize;
+    gst_query_parse_nth_allocation_pool(query, 0, &theirs, &theirSize, &min, &max);
+    if (theirs) gst_object_unref(theirs);
+    if (min < 2) min = 2;
+  }
+
+  GstBufferPool *pool = gst_video_buffer_pool_new();
+  GstStructure *config = gst_buffer_pool_get_config(pool);
+  gst_buffer_pool_config_set_params(config, caps, size, min, max);
+  if (!gst_buffer_pool_set_config(pool, config)) {
+    gst_object_unref(pool);
+    return FALSE;
+  }
+  if (update) gst_query_set_nth_allocation_pool(query, 0, pool, size, min, max);
+  else gst_query_add_allocation_pool(query, pool, size, min, max);
+  gst_object_unref(pool);
+
+  return GST_BASE_SRC_CLASS(gst_lepton_src_parent_class)->decide_allocation(bsrc, query);
+}
+
+static gboolean gst_lepton_src_query(GstBaseSrc *bsrc, GstQuery *query) {
+  if (GST_QUERY_TYPE(query) == GST_QUERY_LATENCY) {
+    gst_query_set_latency(query, TRUE, LEPTON_LATENCY, GST_CLOCK_TIME_NONE);
+    return TRUE;
+  }
+  return GST_BASE_SRC_CLASS(gst_lepton_src_parent_class)->query(bsrc, query);
+}
+
+static gboolean gst_lepton_src_unlock(GstBaseSrc *bsrc) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(bsrc);
+  g_atomic_int_set(&src->flushing, 1);
+  if (src->capture) src->capture->wake();
+  return TRUE;
+}
+
+static gboolean gst_lepton_src_unlock_stop(GstBaseSrc *bsrc) {
+  g_atomic_int_set(&GST_LEPTON_SRC(bsrc)->flushing, 0);
+  return TRUE;
+}
+
+// Capture time (CLOCK_MONOTONIC) -> running time. The pipeline clock is normally the
+// monotonic system clock, and then the offset is 0.
+static GstClockTime capture_pts(GstLeptonSrc *src, uint64_t ts_ns) {
+  GstClock *clock = gst_element_get_clock(GST_ELEMENT(src));
+  if (!clock) return GST_CLOCK_TIME_NONE;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const gint64 now = (gint64)gst_clock_get_time(clock);
+  const gint64 mono = (gint64)ts.tv_sec * GST_SECOND + ts.tv_nsec;
+  const gint64 base = (gint64)gst_element_get_base_time(GST_ELEMENT(src));
+  gst_object_unref(clock);
+  const gint64 t = (gint64)ts_ns + (now - mono) - base;
+  return (t > 0) ? (GstClockTime)t : 0;
+}
+
+static GstFlowReturn gst_lepton_src_fill(GstPushSrc *psrc, GstBuffer *buf) {
+  GstLeptonSrc *src = GST_LEPTON_SRC(psrc);
+  if (!src->capturing) return GST_FLOW_NOT_NEGOTIATED;
+
+  Frame *f;
+  while (!(f = src->capture->next())) {
+    if (src->capture->eos()) return GST_FLOW_EOS;
+    if (g_atomic_int_get(&src->flushing)) return GST_FLOW_FLUSHING;
+  }
+
+  GstMapInfo map;
+  if (!gst_buffer_map(buf, &map, GST_MAP_WRITE)) {
+    src->capture->release();
+    return GST_FLOW_ERROR;
+  }
+  RenderStats st;
+  st.valid = false;
+  if (src->fmt != OUT_Y16) src->path->analyse(f->pix, &f->stats, src->agcEngine, src->clahe, &st);
+  src->ctx.out = map.data;
+  src->path->render(f->pix, &st, &src->ctx);
+  gst_buffer_unmap(buf, &map);
+
+  GST_BUFFER_PTS(buf) = capture_pts(src, f->seg_ts_ns[0]);
+  GST_BUFFER_DTS(buf) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DURATION(buf) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_OFFSET(buf) = f->seq;
+  GST_BUFFER_OFFSET_END(buf) = f->seq + 1;
+  src->capture->release();
+  return GST_FLOW_OK;
+}
+
+static void gst_lepton_src_class_init(GstLeptonSrcClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS(klass);
+  GstPushSrcClass *pushsrc_class = GST_PUSH_SRC_CLASS(klass);
+  const GParamFlags rw = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  gobject_class->finalize = gst_lepton_src_finalize;
+  gobject_class->set_property = gst_lepton_src_set_property;
+  gobject_class->get_property = gst_lepton_src_get_property;
+
+  g_object_class_install_property(gobject_class, PROP_DEVICE,
+    g_param_spec_string("device", "Device", "spidev device (NULL = /dev/spidev0.1)", NULL, rw));
+  g_object_class_install_property(gobject_class, PROP_SOURCE,
+    g_param_spec_string("source", "Source", "packet source: spidev, synth[:opts] or replay:<file>", NULL, rw));
+  g_object_class_install_property(gobject_class, PROP_TYPE,
+    g_param_spec_int("type", "Lepton type", "2 = 80x60, 3 = 160x120", 2, 3, 2, rw));
+  g_object_class_install_property(gobject_class, PROP_TELEMETRY,
+    g_param_spec_string("telemetry", "Telemetry", "telemetry rows: off, header or footer", "off", rw));
+  g_object_class_install_property(gobject_class, PROP_COLORMAP,
+    g_param_spec_int("colormap", "Colormap", "1 rainbow, 2 grayscale, 3 ironblack", 1, 3, 3, rw));
+  g_object_class_install_property(gobject_class, PROP_AGC,
+    g_param_spec_string("agc", "AGC", "linear, clip, heq or clahe", "linear", rw));
+  g_object_class_install_property(gobject_class, PROP_SPI_MHZ,
+    g_param_spec_int("spi-mhz", "SPI MHz", "SPI clock override, 0 = default", 0, 40, 0, rw));
+  g_object_class_install_property(gobject_class, PROP_BATCH,
+    g_param_spec_int("batch", "Batch", "packets per SPI ioctl", 1, 64, 1, rw));
+  g_object_class_install_property(gobject_class, PROP_CHECK_CRC,
+    g_param_spec_boolean("check-crc", "Check CRC", "validate every packet's CRC16", TRUE, rw));
+
+  gst_element_class_set_static_metadata(element_class, "Lepton source", "Source/Video",
+    "Captures a FLIR Lepton over VoSPI and renders it in-process", "v4l2lepton");
+  gst_element_class_add_static_pad_template(element_class, &src_template);
+
+  basesrc_class->start = gst_lepton_src_start;
+  basesrc_class->stop = gst_lepton_src_stop;
+  basesrc_class->get_caps = gst_lepton_src_get_caps;
+  basesrc_class->set_caps = gst_lepton_src_set_caps;
+  basesrc_class->decide_allocation = gst_lepton_src_decide_allocation;
+  basesrc_class->query = gst_lepton_src_query;
+  basesrc_class->unlock = gst_lepton_src_unlock;
+  basesrc_class->unlock_stop = gst_lepton_src_unlock_stop;
+  pushsrc_class->fill = gst_lepton_src_fill;
+
+  GST_DEBUG_CATEGORY_INIT(lepton_src_debug, "leptonsrc", 0, "Lepton source");
+}
+
+static gboolean plugin_init(GstPlugin *plugin) {
+  return gst_element_register(plugin, "leptonsrc", GST_RANK_NONE, GST_TYPE_LEPTON_SRC);
+}
+
+// AGPL-3.0; "GPL" is the nearest licence GStreamer's registry knows.
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, leptonsrc, "FLIR Lepton capture",
+                  plugin_init, "1.0", "GPL", "v4l2lepton", "https://github.com/groupgets/LeptonModule")
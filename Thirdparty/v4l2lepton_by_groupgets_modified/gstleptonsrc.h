@@ -0,0 +1,26 @@
+#ifndef GST_LEPTON_SRC_H
+#define GST_LEPTON_SRC_H
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+
+// leptonsrc: the capture and render core as a live GStreamer source, for pipelines that
+// would otherwise read v4l2lepton's output through v4l2src and a v4l2loopback device.
+//
+//   gst-launch-1.0 leptonsrc type=3 ! video/x-raw,format=NV12 ! v4l2h264enc ! ...
+//
+// Caps are the sensor size (80x60 or 160x120) in any output format of the render paths:
+// RGB, GRAY16_LE (raw counts), GRAY8, YUY2, NV12 or I420; frames are rendered straight into
+// buffers from the element's pool. The frame rate is variable (0/1): each buffer's PTS is
+// the CLOCK_MONOTONIC time its first segment was read, on the pipeline clock.
+//
+// Built by `make gst` into libgstleptonsrc.so; point GST_PLUGIN_PATH at this directory.
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_LEPTON_SRC (gst_lepton_src_get_type())
+G_DECLARE_FINAL_TYPE(GstLeptonSrc, gst_lepton_src, GST, LEPTON_SRC, GstPushSrc)
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,864 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "Palettes.h"
+#include "Capture.h"
+#include "FrameCapture.h"
+#include "RenderKernels.h"
+#include "Render.h"
+
+// leptoncore: the capture and render core as a Python extension module (make python).
+//
+//   import leptoncore, numpy as np
+//   with leptoncore.Camera(type=3, format="rgb") as cam:
+//       f = cam.next_frame()
+//       img = np.asarray(f)            # (120, 160, 3) uint8, read-only, no copy
+//       print(f.timestamp_ns, f.frame_counter, f.min, f.max)
+//
+// A render thread takes frames from the capture thread and renders each one into a buffer
+// from a small pool; next_frame() hands out the newest rendered frame as a Frame object that
+// exports that buffer, read-only, through the buffer protocol. The buffer goes back to the
+// pool when the Frame (and every view of it) is gone, or on Frame.release(). If Python holds
+// every buffer, new frames are dropped rather than waited for, like everywhere else in the
+// core.
+//
+// next_frame() releases the GIL while it waits. For asyncio, fileno() is an eventfd that is
+// readable while a frame is waiting: loop.add_reader(cam.fileno(), ...) and next_frame(0).
+//
+// With history=N the last N frames also stay in the pool, oldest first, for frame_at(t):
+// the frame captured nearest to time t, or (y16 only) a blend of the raw counts of the two
+// captured either side of it.
+// That lets a consumer running at another rate (60 Hz GS against 9 Hz thermal) pair frames
+// by capture time instead of taking whichever thermal frame arrived last.
+
+#define LEPTON_DEFAULT_BUFFERS 4
+#define LEPTON_MAX_BUFFERS 16
+#define LEPTON_MAX_HISTORY 16
+
+struct FrameSlot {
+  uint8_t *data;
+  int refs;                     // render thread while filling it, `ready`, Frame objects
+  uint64_t seq;                 // capture sequence number
+  uint64_t ts_ns;               // CLOCK_MONOTONIC when the frame's first segment was read
+  uint32_t frame_counter;       // telemetry frame counter, 0 without telemetry
+  uint16_t min_v, max_v;        // raw pixel range
+};
+
+struct CameraObject {
+  PyObject_HEAD
+
+  // Settings, fixed at construction.
+  int type;                     // 2 or 3
+  OutFmt fmt;
+  int nslots;                   // buffers + history
+  int histCap;
+  int width, height, frameBytes;
+  CaptureSource *source;
+  FrameCapture *capture;
+  AgcConfig agcCfg;
+  AgcEngine *agc;
+  ClaheEngine *clahe;
+  const RenderKernels *kernels;
+  const RenderPath *path;
+  FrameCaptureConfig fc;
+  RenderContext ctx;            // render thread only
+  uint8_t *stage;
+  Y16RgbLut *y16Lut;            // heq only
+
+  // Under `lock`.
+  FrameSlot slots[LEPTON_MAX_BUFFERS + LEPTON_MAX_HISTORY];
+  int ready;                    // newest rendered slot not handed out yet, -1 = none
+  int hist[LEPTON_MAX_HISTORY]; // last histCap rendered slots, a ring in capture order
+  int histHead, histLen;        // oldest entry, entries
+  bool running;                 // start() to stop()
+  bool stopping;
+  bool finished;                // render thread is done (end of source or stop)
+  unsigned long runs;           // start() calls, so a waiter notices a stop() and restart
+  unsigned long rendered, dropped, replaced;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;          // CLOCK_MONOTONIC
+  int efd;                      // readable while `ready` or `finished`
+  pthread_t renderer;
+};
+
+struct FrameObject {
+  PyObject_HEAD
+  CameraObject *camera;         // keeps the pool alive
+  int slot;                     // -1 once released
+  int exports;                  // buffer views handed out
+  unsigned long long seq, ts_ns;
+  unsigned int frame_counter;
+  unsigned short min_v, max_v;
+  int ndim;
+  Py_ssize_t shape[3], strides[3];
+  Py_ssize_t itemsize;
+};
+
+static PyTypeObject CameraType;
+static PyTypeObject FrameType;
+
+// Array layout of each output format, as numpy and OpenCV expect it. The 4:2:0 formats are
+// one (h * 3 / 2, w) plane, the layout cv2.cvtColor takes for NV12 and I420.
+static void frame_layout(FrameObject *fo, OutFmt fmt, int w, int h) {
+  fo->itemsize = (fmt == OUT_Y16) ? 2 : 1;
+  switch (fmt) {
+    case OUT_RGB24: fo->ndim = 3; fo->shape[0] = h; fo->shape[1] = w; fo->shape[2] = 3; break;
+    case OUT_YUYV: fo->ndim = 3; fo->shape[0] = h; fo->shape[1] = w; fo->shape[2] = 2; break;
+    case OUT_NV12:
+    case OUT_I420: fo->ndim = 2; fo->shape[0] = h * 3 / 2; fo->shape[1] = w; break;
+    default: fo->ndim = 2; fo->shape[0] = h; fo->shape[1] = w; break;
+  }
+  Py_ssize_t stride = fo->itemsize;
+  for (int i = fo->ndim - 1; i >= 0; i--) {
+    fo->strides[i] = stride;
+    stride *= fo->shape[i];
+  }
+}
+
+// Under `lock`: a slot nothing refers to, now held once by the caller, or -1.
+static int camera_claim_slot(CameraObject *self) {
+  for (int i = 0; i < self->nslots; i++) {
+    if (!self->slots[i].refs) {
+      self->slots[i].refs = 1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Under `lock`: the i-th oldest frame in the history.
+static FrameSlot *camera_hist(CameraObject *self, int i) {
+  return &self->slots[self->hist[(self->histHead + i) % self->histCap]];
+}
+
+// Under `lock`.
+static void camera_hist_push(CameraObject *self, int slot) {
+  if (!self->histCap) return;
+  if (self->histLen == self->histCap) {
+    self->slots[self->hist[self->histHead]].refs--;
+    self->histHead = (self->histHead + 1) % self->histCap;
+    self->histLen--;
+  }
+  self->hist[(self->histHead + self->histLen) % self->histCap] = slot;
+  self->slots[slot].refs++;
+  self->histLen++;
+}
+
+static void camera_hist_clear(CameraObject *self) {
+  for (int i = 0; i < self->histLen; i++) camera_hist(self, i)->refs--;
+  self->histHead = self->histLen = 0;
+}
+
+static void camera_signal(CameraObject *self) {
+  const uint64_t one = 1;
+  if (write(self->efd, &one, sizeof(one)) < 0) {}   // EAGAIN: already readable
+}
+
+static void camera_unsignal(CameraObject *self) {
+  uint64_t n;
+  if (read(self->efd, &n, sizeof(n)) < 0) {}
+}
+
+// Render thread: one frame from the capture thread into a free pool buffer at a time. The
+// pool lock is only held to pick a buffer and to publish it.
+static void *camera_render_main(void *arg) {
+  CameraObject *self = (CameraObject *)arg;
+  const int segs = self->capture->segments();
+  for (;;) {
+    Frame *f = self->capture->next();
+    pthread_mutex_lock(&self->lock);
+    const bool stop = self->stopping;
+    pthread_mutex_unlock(&self->lock);
+    if (stop) {
+      if (f) self->capture->release();
+      break;
+    }
+    if (!f) {
+      if (self->capture->eos()) break;
+      continue;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    const int i = camera_claim_slot(self);
+    if (i < 0) self->dropped++;
+    pthread_mutex_unlock(&self->lock);
+    if (i < 0) {
+      self->capture->release();
+      continue;
+    }
+    FrameSlot *s = &self->slots[i];
+
+    RenderStats st;
+    st.valid = false;
+    if (self->fmt != OUT_Y16) self->path->analyse(f->pix, &f->stats, self->agc, self->clahe, &st);
+    self->ctx.out = s->data;
+    self->path->render(f->pix, &st, &self->ctx);
+    s->seq = f->seq;
+    s->ts_ns = f->seg_ts_ns[0];
+    s->frame_counter = f->tele.valid ? f->tele.frame_counter : 0;
+    s->min_v = s->max_v = 0;
+    frame_stats_range(&f->stats, segs, &s->min_v, &s->max_v);
+    self->capture->release();
+
+    pthread_mutex_lock(&self->lock);
+    if (self->ready >= 0) {
+      self->slots[self->ready].refs--;
+      self->replaced++;
+    }
+    self->ready = i;              // the render thread's reference passes to `ready`
+    camera_hist_push(self, i);
+    self->rendered++;
+    camera_signal(self);
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+  }
+
+  pthread_mutex_lock(&self->lock);
+  self->finished = true;
+  camera_signal(self);
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->lock);
+  return NULL;
+}
+
+static void camera_stop_capture(CameraObject *self) {
+  if (!self->running) return;
+  pthread_mutex_lock(&self->lock);
+  self->stopping = true;
+  pthread_cond_broadcast(&self->cond);    // out of next_frame()
+  pthread_mutex_unlock(&self->lock);
+  self->capture->wake();
+  Py_BEGIN_ALLOW_THREADS
+  pthread_join(self->renderer, NULL);
+  self->capture->stop();
+  Py_END_ALLOW_THREADS
+  pthread_mutex_lock(&self->lock);
+  if (self->ready >= 0) self->slots[self->ready].refs--;
+  self->ready = -1;
+  camera_hist_clear(self);
+  self->running = false;
+  self->finished = false;
+  camera_unsignal(self);
+  pthread_mutex_unlock(&self->lock);
+}
+
+// What camera_init() allocates before the FrameCapture, so a failed init leaves nothing
+// behind and can be retried.
+static void camera_free(CameraObject *self) {
+  if (self->efd > 0) close(self->efd);
+  self->efd = 0;
+  delete self->source;
+  delete self->agc;
+  delete self->clahe;
+  free(self->stage);
+  free(self->y16Lut);
+  self->source = NULL;
+  self->agc = NULL;
+  self->clahe = NULL;
+  self->stage = NULL;
+  self->y16Lut = NULL;
+  for (int i = 0; i < LEPTON_MAX_BUFFERS + LEPTON_MAX_HISTORY; i++) {
+    free(self->slots[i].data);
+    self->slots[i].data = NULL;
+  }
+}
+
+static int camera_init(CameraObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "type", "format", "source", "device", "telemetry", "colormap", "agc",
+                                  "spi_mhz", "batch", "check_crc", "buffers", "history", NULL };
+  int type = 3, colormap = 3, spiMhz = 0, batch = 1, checkCrc = 1, buffers = LEPTON_DEFAULT_BUFFERS, history = 0;
+  const char *format = "rgb", *sourceSpec = NULL, *device = NULL, *telemetry = "off", *agc = "linear";
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iszzsisiipii", (char **)kwlist, &type, &format, &sourceSpec,
+                                   &device, &telemetry, &colormap, &agc, &spiMhz, &batch, &checkCrc, &buffers,
+                                   &history)) {
+    return -1;
+  }
+  if (self->capture) {
+    PyErr_SetString(PyExc_RuntimeError, "Camera is already initialised");
+    return -1;
+  }
+  if (type != 2 && type != 3) {
+    PyErr_SetString(PyExc_ValueError, "type expects 2 or 3");
+    return -1;
+  }
+  if (!out_fmt_parse(format, &self->fmt)) {
+    PyErr_SetString(PyExc_ValueError, "format expects rgb, y16, grey, yuyv, nv12 or i420");
+    return -1;
+  }
+  TelemetryMode tm;
+  if (strcmp(telemetry, "header") == 0) tm = TELEMETRY_HEADER;
+  else if (strcmp(telemetry, "footer") == 0) tm = TELEMETRY_FOOTER;
+  else if (strcmp(telemetry, "off") == 0) tm = TELEMETRY_OFF;
+  else {
+    PyErr_SetString(PyExc_ValueError, "telemetry expects off, header or footer");
+    return -1;
+  }
+  self->agcCfg = AgcConfig();
+  if (!agc_mode_parse(agc, &self->agcCfg.mode)) {
+    PyErr_SetString(PyExc_ValueError, "agc expects linear, clip, heq or clahe");
+    return -1;
+  }
+  if (colormap < 1 || colormap > 3) {
+    PyErr_SetString(PyExc_ValueError, "colormap expects 1 (rainbow), 2 (grayscale) or 3 (ironblack)");
+    return -1;
+  }
+  if (buffers < 2 || buffers > LEPTON_MAX_BUFFERS) {
+    PyErr_Format(PyExc_ValueError, "buffers expects 2..%d", LEPTON_MAX_BUFFERS);
+    return -1;
+  }
+  if (history < 0 || history > LEPTON_MAX_HISTORY) {
+    PyErr_Format(PyExc_ValueError, "history expects 0..%d", LEPTON_MAX_HISTORY);
+    return -1;
+  }
+  self->type = type;
+  self->path = render_path_select(type, self->fmt, self->agcCfg.mode);
+  if (!self->path) {
+    PyErr_SetString(PyExc_ValueError, "no render path for this type, format and agc");
+    return -1;
+  }
+  self->width = self->path->width;
+  self->height = self->path->height;
+  self->frameBytes = self->path->frameBytes;
+  self->kernels = render_kernels_select("auto");
+
+  CaptureConfig cc;
+  cc.typeLepton = type;
+  cc.spidev = (char *)device;
+  cc.spi_mhz = spiMhz;
+  cc.batch = batch;
+  cc.verbose = 0;
+  self->source = capture_create(sourceSpec, &cc);
+  if (!self->source) {
+    PyErr_Format(PyExc_ValueError, "bad source '%s'", sourceSpec);
+    return -1;
+  }
+
+  self->agc = new AgcEngine();
+  self->agc->configure(self->agcCfg);
+  if (self->agcCfg.mode == AGC_CLAHE) {
+    self->clahe = new ClaheEngine();
+    if (!self->clahe->configure(ClaheConfig(), self->width, self->height)) {
+      PyErr_SetString(PyExc_RuntimeError, "clahe setup failed");
+      camera_free(self);
+      return -1;
+    }
+  }
+  self->stage = (uint8_t *)malloc(MAX_WIDTH * MAX_HEIGHT * 3);
+  if (self->agcCfg.mode == AGC_HEQ) self->y16Lut = (Y16RgbLut *)calloc(1, sizeof(Y16RgbLut));
+  if (!self->stage || (self->agcCfg.mode == AGC_HEQ && !self->y16Lut)) {
+    PyErr_NoMemory();
+    camera_free(self);
+    return -1;
+  }
+  self->nslots = buffers + history;
+  self->histCap = history;
+  for (int i = 0; i < self->nslots; i++) {
+    if (posix_memalign((void **)&self->slots[i].data, 64, self->frameBytes)) {
+      self->slots[i].data = NULL;
+      PyErr_NoMemory();
+      camera_free(self);
+      return -1;
+    }
+    memset(self->slots[i].data, 0, self->frameBytes);
+  }
+
+  RenderContext *ctx = &self->ctx;
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->kernels = self->kernels;
+  ctx->palette = (self->fmt == OUT_RGB24) ? palette_rgbx(colormap) : palette_yuvx(colormap, self->fmt == OUT_GREY);
+  ctx->stage = self->stage;
+  ctx->y16Lut = (self->fmt != OUT_Y16) ? self->y16Lut : NULL;
+
+  FrameCaptureConfig *fc = &self->fc;
+  memset(fc, 0, sizeof(*fc));
+  fc->typeLepton = type;
+  fc->telemetry = tm;
+  fc->checkCrc = checkCrc;
+  fc->keepHist = self->fmt != OUT_Y16 && (self->agcCfg.mode == AGC_CLIP || self->agcCfg.mode == AGC_HEQ);
+  fc->path = self->path;
+  fc->kernels = self->kernels;
+  fc->cpu = -1;
+
+  self->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (self->efd < 0) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    self->efd = 0;
+    camera_free(self);
+    return -1;
+  }
+  pthread_condattr_t ca;
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&self->cond, &ca);
+  pthread_condattr_destroy(&ca);
+  pthread_mutex_init(&self->lock, NULL);
+  self->ready = -1;
+  self->capture = new FrameCapture();
+  return 0;
+}
+
+static void camera_dealloc(CameraObject *self) {
+  if (self->capture) {
+    camera_stop_capture(self);
+    delete self->capture;
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->cond);
+  }
+  camera_free(self);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static bool camera_check(CameraObject *self) {
+  if (!self->capture) {
+    PyErr_SetString(PyExc_RuntimeError, "Camera is not initialised");
+    return false;
+  }
+  return true;
+}
+
+static PyObject *camera_start(CameraObject *self, PyObject *) {
+  if (!camera_check(self)) return NULL;
+  if (self->running) Py_RETURN_NONE;
+  self->capture->configure(self->source, self->fc);
+  self->agc->reset();
+  bool ok;
+  Py_BEGIN_ALLOW_THREADS
+  ok = self->capture->start();
+  Py_END_ALLOW_THREADS
+  if (!ok) {
+    PyErr_Format(PyExc_OSError, "cannot open %s", self->source->name());
+    return NULL;
+  }
+  pthread_mutex_lock(&self->lock);
+  self->stopping = false;
+  self->finished = false;
+  self->running = true;
+  self->runs++;
+  pthread_mutex_unlock(&self->lock);
+  if (pthread_create(&self->renderer, NULL, camera_render_main, self) != 0) {
+    self->capture->stop();
+    pthread_mutex_lock(&self->lock);
+    self->running = false;
+    pthread_mutex_unlock(&self->lock);
+    PyErr_SetString(PyExc_RuntimeError, "cannot start the render thread");
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *camera_stop(CameraObject *self, PyObject *) {
+  if (!camera_check(self)) return NULL;
+  camera_stop_capture(self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *camera_enter(CameraObject *self, PyObject *) {
+  PyObject *r = camera_start(self, NULL);
+  if (!r) return NULL;
+  Py_DECREF(r);
+  Py_INCREF(self);
+  return (PyObject *)self;
+}
+
+static PyObject *camera_exit(CameraObject *self, PyObject *) {
+  return camera_stop(self, NULL);
+}
+
+static FrameObject *frame_new(CameraObject *self, int slot) {
+  FrameObject *fo = PyObject_New(FrameObject, &FrameType);
+  if (!fo) return NULL;
+  const FrameSlot *s = &self->slots[slot];
+  Py_INCREF(self);
+  fo->camera = self;
+  fo->slot = slot;
+  fo->exports = 0;
+  fo->seq = s->seq;
+  fo->ts_ns = s->ts_ns;
+  fo->frame_counter = s->frame_counter;
+  fo->min_v = s->min_v;
+  fo->max_v = s->max_v;
+  frame_layout(fo, self->fmt, self->width, self->height);
+  return fo;
+}
+
+static void camera_put_slot(CameraObject *self, int slot) {
+  pthread_mutex_lock(&self->lock);
+  self->slots[slot].refs--;
+  pthread_mutex_unlock(&self->lock);
+}
+
+// Wait for the next frame, in slices so Ctrl-C still gets through a blocking wait.
+static PyObject *camera_next_frame(CameraObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "timeout", NULL };
+  PyObject *timeoutObj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char **)kwlist, &timeoutObj)) return NULL;
+  if (!camera_check(self)) return NULL;
+  double timeout = -1;
+  if (timeoutObj != Py_None) {
+    timeout = PyFloat_AsDouble(timeoutObj);
+    if (timeout == -1 && PyErr_Occurred()) return NULL;
+    if (timeout < 0) timeout = 0;
+  }
+  if (!self->running) {
+    PyErr_SetString(PyExc_RuntimeError, "Camera is not started");
+    return NULL;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint64_t start = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  const uint64_t deadline = (timeout < 0) ? UINT64_MAX : start + (uint64_t)(timeout * 1e9);
+  int slot = -1;
+  bool finished = false, stopped = false;
+  pthread_mutex_lock(&self->lock);
+  const unsigned long run = self->runs;
+  pthread_mutex_unlock(&self->lock);
+  uint64_t t;
+  for (;;) {
+    Py_BEGIN_ALLOW_THREADS
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    t = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec + 100000000ull;
+    if (t > deadline) t = deadline;
+    struct timespec until;
+    until.tv_sec = t / 1000000000ull;
+    until.tv_nsec = t % 1000000000ull;
+    pthread_mutex_lock(&self->lock);
+    for (;;) {
+      stopped = self->stopping || !self->running || self->runs != run;
+      if (stopped || self->ready >= 0 || self->finished) break;
+      if (pthread_cond_timedwait(&self->cond, &self->lock, &until) == ETIMEDOUT) break;
+    }
+    if (!stopped && self->ready >= 0) {
+      slot = self->ready;           // `ready`'s reference passes to the Frame
+      self->ready = -1;
+      camera_unsignal(self);
+    }
+    finished = self->finished;
+    pthread_mutex_unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (slot >= 0 || stopped || finished || t >= deadline) break;
+    if (PyErr_CheckSignals() < 0) return NULL;
+  }
+
+  if (slot < 0) {
+    if (stopped) {
+      PyErr_SetString(PyExc_RuntimeError, "Camera was stopped");
+      return NULL;
+    }
+    if (finished) {
+      PyErr_SetString(PyExc_EOFError, "end of source");
+      return NULL;
+    }
+    Py_RETURN_NONE;
+  }
+  FrameObject *fo = frame_new(self, slot);
+  if (!fo) camera_put_slot(self, slot);
+  return (PyObject *)fo;
+}
+
+// out = a + (b - a) * w / 256, per raw count.
+static void blend_q8(uint16_t *out, const uint16_t *a, const uint16_t *b, int n, int w) {
+  for (int i = 0; i < n; i++) out[i] = (uint16_t)(a[i] + (((int)b[i] - a[i]) * w >> 8));
+}
+
+// Nearest frame to `t`, or with `interpolate` a blend of the frames captured either side of
+// it, weighted by time. Outside the history it is the oldest or the newest frame: nothing
+// is extrapolated. A blend needs a free pool buffer; without one it is the nearest frame.
+// Only raw counts (y16) are blended: every rendered frame has its own AGC stretch and goes
+// through a palette, so mixing two of those is a crossfade, not the scene in between.
+static PyObject *camera_frame_at(CameraObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "t", "interpolate", NULL };
+  unsigned long long t;
+  int interpolate = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|p", (char **)kwlist, &t, &interpolate)) return NULL;
+  if (!camera_check(self)) return NULL;
+  if (interpolate && self->fmt != OUT_Y16) {
+    PyErr_SetString(PyExc_ValueError, "interpolate needs format='y16'; render the blended counts yourself");
+    return NULL;
+  }
+  if (!self->histCap) {
+    PyErr_SetString(PyExc_RuntimeError, "Camera has no history (history=0)");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (!self->histLen) {
+    pthread_mutex_unlock(&self->lock);
+    Py_RETURN_NONE;
+  }
+  int j = 0;
+  while (j < self->histLen && camera_hist(self, j)->ts_ns < t) j++;
+  FrameSlot *a = camera_hist(self, (j > 0) ? j - 1 : 0);
+  FrameSlot *b = camera_hist(self, (j < self->histLen) ? j : self->histLen - 1);
+  FrameSlot *nearest = (t - a->ts_ns <= b->ts_ns - t) ? a : b;
+  int blend = -1;
+  if (interpolate && a != b && b->ts_ns > a->ts_ns) blend = camera_claim_slot(self);
+  if (blend < 0) {
+    const int slot = (int)(nearest - self->slots);
+    nearest->refs++;
+    pthread_mutex_unlock(&self->lock);
+    FrameObject *fo = frame_new(self, slot);
+    if (!fo) camera_put_slot(self, slot);
+    return (PyObject *)fo;
+  }
+  a->refs++;
+  b->refs++;
+  pthread_mutex_unlock(&self->lock);
+
+  FrameSlot *o = &self->slots[blend];
+  const int w = (int)(((t - a->ts_ns) << 8) / (b->ts_ns - a->ts_ns));
+  Py_BEGIN_ALLOW_THREADS
+  blend_q8((uint16_t *)o->data, (const uint16_t *)a->data, (const uint16_t *)b->data, self->frameBytes / 2, w);
+  Py_END_ALLOW_THREADS
+  o->seq = a->seq;
+  o->ts_ns = t;
+  o->frame_counter = a->frame_counter;
+  o->min_v = (uint16_t)(a->min_v + (((int)b->min_v - a->min_v) * w >> 8));
+  o->max_v = (uint16_t)(a->max_v + (((int)b->max_v - a->max_v) * w >> 8));
+  camera_put_slot(self, (int)(a - self->slots));
+  camera_put_slot(self, (int)(b - self->slots));
+
+  FrameObject *fo = frame_new(self, blend);
+  if (!fo) camera_put_slot(self, blend);
+  return (PyObject *)fo;
+}
+
+// (oldest, newest) capture time in the history, or None while it is empty.
+static PyObject *camera_history_span(CameraObject *self, PyObject *) {
+  if (!camera_check(self)) return NULL;
+  pthread_mutex_lock(&self->lock);
+  const int n = self->histLen;
+  const unsigned long long lo = n ? camera_hist(self, 0)->ts_ns : 0;
+  const unsigned long long hi = n ? camera_hist(self, n - 1)->ts_ns : 0;
+  pthread_mutex_unlock(&self->lock);
+  if (!n) Py_RETURN_NONE;
+  return Py_BuildValue("(KK)", lo, hi);
+}
+
+static PyObject *camera_fileno(CameraObject *self, PyObject *) {
+  if (!camera_check(self)) return NULL;
+  return PyLong_FromLong(self->efd);
+}
+
+static unsigned long camera_counter(CameraObject *self, unsigned long CameraObject::*field) {
+  pthread_mutex_lock(&self->lock);
+  const unsigned long v = self->*field;
+  pthread_mutex_unlock(&self->lock);
+  return v;
+}
+
+static PyObject *camera_get_stats(CameraObject *self, void *) {
+  if (!camera_check(self)) return NULL;
+  return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k,s:k}",
+                       "rendered", camera_counter(self, &CameraObject::rendered),
+                       "dropped", camera_counter(self, &CameraObject::dropped),
+                       "replaced", camera_counter(self, &CameraObject::replaced),
+                       "crc_errors", self->capture->crc_errors(),
+                       "sync_losses", self->capture->sync_losses(),
+                       "resyncs", self->capture->resyncs().count);
+}
+
+static PyObject *camera_get_format(CameraObject *self, void *) {
+  static const char *names[OUT_COUNT] = { "rgb", "y16", "grey", "yuyv", "nv12", "i420" };
+  if (!camera_check(self)) return NULL;
+  return PyUnicode_FromString(names[self->fmt]);
+}
+
+static PyObject *camera_get_running(CameraObject *self, void *) {
+  return PyBool_FromLong(self->running);
+}
+
+static PyMethodDef camera_methods[] = {
+  { "start", (PyCFunction)camera_start, METH_NOARGS, "Open the source and start capturing." },
+  { "stop", (PyCFunction)camera_stop, METH_NOARGS,
+    "Stop capturing and close the source. Frames already handed out stay valid." },
+  { "next_frame", (PyCFunction)(void (*)(void))camera_next_frame, METH_VARARGS | METH_KEYWORDS,
+    "next_frame(timeout=None) -> Frame or None\n\n"
+    "The newest frame not returned yet; frames rendered in between are skipped. Waits up to\n"
+    "`timeout` seconds (None: until one arrives, 0: not at all) and returns None if none came.\n"
+    "Raises EOFError at the end of a finite source, RuntimeError if stop() is called meanwhile." },
+  { "frame_at", (PyCFunction)(void (*)(void))camera_frame_at, METH_VARARGS | METH_KEYWORDS,
+    "frame_at(t, interpolate=False) -> Frame or None\n\n"
+    "From the history: the frame captured nearest to `t` (time.monotonic_ns() clock), or with\n"
+    "`interpolate` (format='y16' only) a blend of the raw counts of the two captured either\n"
+    "side of it, stamped `t`. Clamped to the oldest and newest frame; None while the history\n"
+    "is empty." },
+  { "history_span", (PyCFunction)camera_history_span, METH_NOARGS,
+    "(oldest, newest) capture time in the history, or None." },
+  { "fileno", (PyCFunction)camera_fileno, METH_NOARGS,
+    "An eventfd that is readable while next_frame(0) would return a frame (or raise EOFError)." },
+  { "__enter__", (PyCFunction)camera_enter, METH_NOARGS, NULL },
+  { "__exit__", (PyCFunction)camera_exit, METH_VARARGS, NULL },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyMemberDef camera_members[] = {
+  { (char *)"width", T_INT, offsetof(CameraObject, width), READONLY, NULL },
+  { (char *)"height", T_INT, offsetof(CameraObject, height), READONLY, NULL },
+  { (char *)"buffers", T_INT, offsetof(CameraObject, nslots), READONLY, (char *)"size of the frame buffer pool" },
+  { (char *)"history", T_INT, offsetof(CameraObject, histCap), READONLY, (char *)"frames kept for frame_at()" },
+  { NULL, 0, 0, 0, NULL }
+};
+
+static PyGetSetDef camera_getset[] = {
+  { (char *)"format", (getter)camera_get_format, NULL, NULL, NULL },
+  { (char *)"running", (getter)camera_get_running, NULL, NULL, NULL },
+  { (char *)"stats", (getter)camera_get_stats, NULL,
+    (char *)"rendered, dropped (no free buffer), replaced (never taken), crc_errors, sync_losses, resyncs", NULL },
+  { NULL, NULL, NULL, NULL, NULL }
+};
+
+static void frame_release_slot(FrameObject *fo) {
+  if (fo->slot < 0) return;
+  camera_put_slot(fo->camera, fo->slot);
+  fo->slot = -1;
+}
+
+static void frame_dealloc(FrameObject *fo) {
+  frame_release_slot(fo);
+  Py_XDECREF(fo->camera);
+  PyObject_Free(fo);
+}
+
+static PyObject *frame_release(FrameObject *fo, PyObject *) {
+  if (fo->exports) {
+    PyErr_SetString(PyExc_BufferError, "frame buffer is still in use");
+    return NULL;
+  }
+  frame_release_slot(fo);
+  Py_RETURN_NONE;
+}
+
+static int frame_getbuffer(FrameObject *fo, Py_buffer *view, int flags) {
+  if (fo->slot < 0) {
+    PyErr_SetString(PyExc_BufferError, "frame has been released");
+    return -1;
+  }
+  // The slot may be shared with the history and other Frames, so nobody writes into it.
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "frame buffers are read-only");
+    return -1;
+  }
+  CameraObject *cam = fo->camera;
+  void *data = cam->slots[fo->slot].data;
+  // Callers that want neither a shape nor a format get plain bytes.
+  if ((flags & PyBUF_ND) != PyBUF_ND || (!(flags & PyBUF_FORMAT) && fo->itemsize != 1)) {
+    if (PyBuffer_FillInfo(view, (PyObject *)fo, data, cam->frameBytes, 1, flags) < 0) return -1;
+  } else {
+    view->buf = data;
+    view->obj = (PyObject *)fo;
+    Py_INCREF(fo);
+    view->len = cam->frameBytes;
+    view->readonly = 1;
+    view->itemsize = fo->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)((fo->itemsize == 2) ? "<H" : "B") : NULL;
+    view->ndim = fo->ndim;
+    view->shape = fo->shape;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? fo->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+  }
+  fo->exports++;
+  return 0;
+}
+
+static void frame_releasebuffer(FrameObject *fo, Py_buffer *) {
+  fo->exports--;
+}
+
+static PyObject *frame_get_format(FrameObject *fo, void *) {
+  return camera_get_format(fo->camera, NULL);
+}
+
+static PyObject *frame_get_shape(FrameObject *fo, void *) {
+  PyObject *t = PyTuple_New(fo->ndim);
+  if (!t) return NULL;
+  for (int i = 0; i < fo->ndim; i++) PyTuple_SET_ITEM(t, i, PyLong_FromSsize_t(fo->shape[i]));
+  return t;
+}
+
+static PyObject *frame_repr(FrameObject *fo) {
+  return PyUnicode_FromFormat("<leptoncore.Frame seq=%llu ts=%llu %dx%d%s>", fo->seq, fo->ts_ns,
+                              fo->camera->width, fo->camera->height, (fo->slot < 0) ? " released" : "");
+}
+
+static PyMethodDef frame_methods[] = {
+  { "release", (PyCFunction)frame_release, METH_NOARGS,
+    "Give the buffer back to the pool now rather than when the Frame is collected." },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyMemberDef frame_members[] = {
+  { (char *)"seq", T_ULONGLONG, offsetof(FrameObject, seq), READONLY, (char *)"capture sequence number" },
+  { (char *)"timestamp_ns", T_ULONGLONG, offsetof(FrameObject, ts_ns), READONLY,
+    (char *)"CLOCK_MONOTONIC (time.monotonic_ns()) when the frame's first segment was read" },
+  { (char *)"frame_counter", T_UINT, offsetof(FrameObject, frame_counter), READONLY,
+    (char *)"Lepton telemetry frame counter, 0 without telemetry" },
+  { (char *)"min", T_USHORT, offsetof(FrameObject, min_v), READONLY, (char *)"lowest raw pixel value" },
+  { (char *)"max", T_USHORT, offsetof(FrameObject, max_v), READONLY, (char *)"highest raw pixel value" },
+  { NULL, 0, 0, 0, NULL }
+};
+
+static PyGetSetDef frame_getset[] = {
+  { (char *)"format", (getter)frame_get_format, NULL, NULL, NULL },
+  { (char *)"shape", (getter)frame_get_shape, NULL, (char *)"array shape of the buffer", NULL },
+  { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyBufferProcs frame_as_buffer = {
+  (getbufferproc)frame_getbuffer,
+  (releasebufferproc)frame_releasebuffer,
+};
+
+static struct PyModuleDef leptoncore_module = {
+  PyModuleDef_HEAD_INIT, "leptoncore",
+  "Lepton capture and render core; frames are pooled native buffers exported without a copy.",
+  -1, NULL, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_leptoncore(void) {
+  CameraType.tp_name = "leptoncore.Camera";
+  CameraType.tp_basicsize = sizeof(CameraObject);
+  CameraType.tp_flags = Py_TPFLAGS_DEFAULT;
+  CameraType.tp_doc = "Camera(type=3, format='rgb', source=None, device=None, telemetry='off', colormap=3,\n"
+                      "       agc='linear', spi_mhz=0, batch=1, check_crc=True, buffers=4, history=0)";
+  CameraType.tp_new = PyType_GenericNew;
+  CameraType.tp_init = (initproc)camera_init;
+  CameraType.tp_dealloc = (destructor)camera_dealloc;
+  CameraType.tp_methods = camera_methods;
+  CameraType.tp_members = camera_members;
+  CameraType.tp_getset = camera_getset;
+
+  FrameType.tp_name = "leptoncore.Frame";
+  FrameType.tp_basicsize = sizeof(FrameObject);
+  FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+  FrameType.tp_doc = "A rendered frame; supports the buffer protocol (np.asarray(frame), memoryview(frame)).";
+  FrameType.tp_dealloc = (destructor)frame_dealloc;
+  FrameType.tp_repr = (reprfunc)frame_repr;
+  FrameType.tp_as_buffer = &frame_as_buffer;
+  FrameType.tp_methods = frame_methods;
+  FrameType.tp_members = frame_members;
+  FrameType.tp_getset = frame_getset;
+
+  if (PyType_Ready(&CameraType) < 0 || PyType_Ready(&FrameType) < 0) return NULL;
+  PyObject *m = PyModule_Create(&leptoncore_module);
+  if (!m) return NULL;
+  Py_INCREF(&CameraType);
+  Py_INCREF(&FrameType);
+  if (PyModule_AddObject(m, "Camera", (PyObject *)&CameraType) < 0 ||
+      PyModule_AddObject(m, "Frame", (PyObject *)&FrameType) < 0) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
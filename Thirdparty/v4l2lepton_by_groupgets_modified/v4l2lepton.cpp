@@ -8,414 +8,458 @@
 #include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/videodev2.h>
-#include <linux/spi/spidev.h>
 #include <getopt.h>
+#include <atomic>
 
 #include "Palettes.h"
-#include "SPI.h"
 #include "Lepton_I2C.h"
-
-#define PACKET_SIZE 164
-#define PACKET_SIZE_UINT16 (PACKET_SIZE/2)       // 82
-#define PACKETS_PER_FRAME 60                     // payload packets per segment/frame (telemetry-disabled base)
-#define FRAME_SIZE_UINT16 (PACKET_SIZE_UINT16*PACKETS_PER_FRAME)
-
-// Colormap is 256 levels * 3 channels = 768 ints (do NOT scan until -1 to avoid OOB crash)
-#define COLORMAP_SIZE 768
-
-static const char *v4l2dev = "/dev/video1";
+#include "TripleBuffer.h"
+#include "VoSPI.h"
+#include "Capture.h"
+#include "Recording.h"
+#include "SpiTune.h"
+#include "FrameCapture.h"
+#include "Consumers.h"
+#include "RenderKernels.h"
+#include "Render.h"
+#include "V4l2Stream.h"
+#include "ShmRing.h"
+
+#define MAX_OUTPUTS 4
+
+static const char *v4l2dev = "/dev/video1";   // default --video
 static const char *spidev_default = "/dev/spidev0.1";
 static char *spidev = NULL;
+static const char *sourceSpec = NULL;   // --source, NULL = spidev
+static CaptureSource *source = NULL;
+static unsigned long maxFrames = 0;     // --frames, 0 = run forever
+static const char *recordPath = NULL;   // --record
+static RecordingWriter recorder;
+
+// Per-output settings: --out, --colormap, --size, --scale and --io apply to the --video they
+// follow; given before the first --video they are the defaults for every output.
+struct OutputConfig {
+  const char *dev;
+  OutFmt fmt;
+  int colormap;                // 1 rainbow, 2 grayscale, 3 ironblack
+  int width, height;           // --size, 0 = the sensor's
+  ScaleFilter filter;
+  bool mmapIo;                 // --io mmap
+};
 
-static int v4l2sink = -1;
-static int width = 80;
-static int height = 60;
+// One sink, rendered from the shared frame on the render thread and written by its own
+// thread. Three buffers go round between the two (TripleBuffer): render never waits for the
+// writer, and the writer always sends the newest complete frame, so a slow or stalled
+// reader costs frames on its own output only, never capture or the other outputs. Plain
+// files are the exception: they get every frame, render waiting for the writer if need be.
+// With --io mmap the driver's buffers take the place of all that (V4l2Stream), and a
+// shm:<name> sink is rendered straight into its shared-memory ring (ShmRing).
+struct Output {
+  OutputConfig cfg;
+  const RenderPath *path;
+  RenderContext ctx;
+  Scaler scaler;
+  bool scaling;                // --size differs from the sensor size
+  int fd;
+  int sink;                    // ConsumerWatch sink id
+  char *buf[3];
+  int size;
+  TripleBuffer xchg;           // buf indices between render and writer
+  sem_t ready;                 // posted for every published frame
+  sem_t taken;                 // posted for every frame the writer takes
+  bool lossless;               // plain file: never replace a frame
+  unsigned long seq[3];        // frame number in each buffer
+  unsigned long published;     // render thread only
+  unsigned long replaced;      // published frames the writer never got to (render thread)
+  std::atomic<unsigned long> written;   // frame number last written
+  pthread_mutex_t sentLock;
+  pthread_cond_t sent;         // signalled after every write, CLOCK_MONOTONIC
+  pthread_t writer;
+  V4l2Stream stream;
+  bool streaming;              // rendered into driver buffers, no writer thread
+  unsigned long dropped;       // streaming: frames without a free driver buffer
+  ShmRingWriter ring;
+  bool shm;                    // shm:<name> sink
+};
+
+static OutputConfig outDefaults = { NULL, OUT_RGB24, 3, 0, 0, SCALE_BILINEAR, false };
+static Output outputs[MAX_OUTPUTS];
+static int nOutputs = 0;
+static int nMapped = 0;        // outputs that go through the AGC (all but y16)
 
-enum OutFmt { OUT_RGB24 = 0, OUT_Y16 = 1 };
 static int typeLepton = 2;     // 2 or 3
-static enum OutFmt outFmt = OUT_RGB24;
-static int typeColormap = 3;   // 1 rainbow, 2 grayscale, 3 ironblack
+static const char *simdName = "auto";
+static const RenderKernels *kernels = NULL;   // per-pixel loops for this CPU
+static bool useY16Lut = false;                 // --y16-lut
+static AgcConfig agcCfg;
+static AgcEngine agc;
+static ClaheConfig claheCfg;
+static ClaheEngine clahe;
+static const RenderPath *renderPath = NULL;   // decode and analysis (the first output's path)
 static int verbose = 0;
 
-static int spi_mhz = 0;
+static TelemetryMode telemetryMode = TELEMETRY_OFF;
 
-static char *vidsendbuf = NULL;
-static int vidsendsiz = 0;
+static int spi_mhz = 0;
+static int spi_batch = 1;      // packets per SPI ioctl (1 = one read() per packet)
+static bool checkCrc = true;   // validate every packet's CRC16 (--no-crc to skip)
 
-static pthread_t sender;
-static sem_t lock1, lock2;
+static bool spiAuto = false;   // --spi-auto: pick the SPI clock from the live error rate
+static const char *spiStatePath = NULL;
+static SpiTuneConfig spiTuneCfg;
 
-static uint8_t result[PACKET_SIZE * PACKETS_PER_FRAME];
-static uint8_t shelf[4][PACKET_SIZE * PACKETS_PER_FRAME];
+static ConsumerWatch consumers;   // capture runs only while somebody reads an output
 
-// Telemetry alignment: stash next segment's packet0 if we peek it
-static bool stash_valid = false;
-static uint8_t stash_pkt[PACKET_SIZE];
-
-static inline const int* pick_colormap(int cm) {
-  switch (cm) {
-    case 1: return colormap_rainbow;
-    case 2: return colormap_grayscale;
-    default: return colormap_ironblack;
-  }
-}
+// Capture thread: drains SPI only and hands finished frames to the render thread.
+static int rt_prio = 0;        // SCHED_FIFO priority for the capture thread (0 = normal)
+static int capture_cpu = -1;   // CPU to pin the capture thread to (-1 = any)
+static FrameCapture capture;
 
 static void usage(const char *exec) {
   printf(
     "Usage: %s [options]\n"
     "Options:\n"
     "  -d | --device    <dev>     spidev device (default: %s)\n"
-    "  -v | --video     <dev>     v4l2loopback device (default: %s)\n"
+    "  -S | --source    <spec>    packet source: spidev (default), synth[:opts], replay:<file>[,loop]\n"
+    "                             synth opts: rt,seed=N,ber=X,invalid=N,discard=N,telemetry\n"
+    "  -v | --video     <dev>     v4l2loopback device, file:<path> for raw frames, or shm:<name>\n"
+    "                             for a shared-memory ring in /dev/shm (default: %s);\n"
+    "                             repeat for up to 4 outputs of one capture, each taking the\n"
+    "                             -o, -c, -W, -f and -I that follow it\n"
     "  -t | --type      2|3       Lepton type (2=80x60, 3=160x120)\n"
-    "  -o | --out       rgb|y16   output format (default: rgb)\n"
+    "  -o | --out       <fmt>     output format: rgb (default), y16 (raw counts), or the palette in\n"
+    "                             grey, yuyv, nv12 or i420 (BT.601) to feed an encoder directly\n"
+    "  -T | --telemetry off|header|footer  telemetry rows enabled on the camera (default: off);\n"
+    "                             repeated frames (same frame counter) are then not re-rendered\n"
     "  -c | --colormap  1|2|3     1=rainbow 2=grayscale 3=ironblack (default: 3)\n"
+    "  -m | --simd      <name>    render kernels: auto (default) or one of %s\n"
+    "  -g | --agc       linear|clip|heq|clahe  AGC for RGB output (default: linear): frame\n"
+    "                             min..max, min..max between percentiles, plateau histogram\n"
+    "                             equalisation, or tiled local equalisation (CLAHE)\n"
+    "  -C | --agc-clip  <low>[:<high>]  clip: percent of pixels cut off each end (default: 1:1)\n"
+    "  -p | --agc-plateau <pct>   heq: bin cap in percent of the pixels (default: 3)\n"
+    "  -D | --agc-damp  <0..1>    share of the previous frame's AGC mapping kept (default: 0)\n"
+    "  -X | --clahe-tiles <X>x<Y> clahe: tile grid, must divide the frame (default: 20x15 px tiles)\n"
+    "  -l | --clahe-clip <F>      clahe: histogram bin cap, times the average bin (default: 3)\n"
+    "  -j | --clahe-threads <N>   clahe: worker threads incl. the render thread (default: CPUs, max 4)\n"
+    "  -W | --size      <W>x<H>   output size, e.g. 1280x720 (default: the sensor's); not for y16\n"
+    "  -f | --scale     nearest|bilinear|bicubic  --size filter (default: bilinear)\n"
+    "  -I | --io        write|mmap  how frames reach a V4L2 output: write() (default), or\n"
+    "                             rendered into mapped driver buffers queued with the capture\n"
+    "                             time and frame number (falls back to write() if unsupported)\n"
+    "  -L | --y16-lut             map RGB output through a 64K-entry value->RGB table, refilled\n"
+    "                             only when the frame's min/max changes\n"
     "  -s | --spi-mhz   <N>       override SPI speed after open (e.g. 20)\n"
+    "  -A | --spi-auto  <min>:<max>[:<err/s>]  step the SPI clock (MHz) within the range to the\n"
+    "                             fastest one below err/s link errors (default 1) and save it\n"
+    "  -P | --spi-state <file>    where --spi-auto keeps the chosen clock\n"
+    "                             (default: /var/tmp/v4l2lepton-<spidev>.spi)\n"
+    "  -k | --no-crc              do not check packet CRCs\n"
+    "  -b | --batch     <N>       packets per SPI ioctl (default: 1; capped by spidev bufsiz)\n"
+    "  -r | --rt-prio   <N>       run the capture thread SCHED_FIFO at priority N\n"
+    "  -a | --cpu       <N>       pin the capture thread to CPU N\n"
+    "  -R | --record    <file>    also record validated raw packets to a capture file\n"
+    "  -n | --frames    <N>       exit after N frames (e.g. for benchmarking a synth/replay source)\n"
     "  -V | --verbose             debug prints\n"
     "  -h | --help\n",
-    exec, spidev_default, v4l2dev
+    exec, spidev_default, v4l2dev, render_kernels_available()
   );
 }
 
-static const char short_options[] = "d:hv:t:o:c:s:V";
+static const char short_options[] = "d:S:hv:t:o:T:c:m:g:C:p:D:X:l:j:W:f:I:Ls:A:P:kb:r:a:R:n:V";
 static const struct option long_options[] = {
   { "device",    required_argument, NULL, 'd' },
+  { "source",    required_argument, NULL, 'S' },
   { "help",      no_argument,       NULL, 'h' },
   { "video",     required_argument, NULL, 'v' },
   { "type",      required_argument, NULL, 't' },
   { "out",       required_argument, NULL, 'o' },
+  { "telemetry", required_argument, NULL, 'T' },
   { "colormap",  required_argument, NULL, 'c' },
+  { "simd",      required_argument, NULL, 'm' },
+  { "agc",       required_argument, NULL, 'g' },
+  { "agc-clip",  required_argument, NULL, 'C' },
+  { "agc-plateau", required_argument, NULL, 'p' },
+  { "agc-damp",  required_argument, NULL, 'D' },
+  { "clahe-tiles", required_argument, NULL, 'X' },
+  { "clahe-clip",  required_argument, NULL, 'l' },
+  { "clahe-threads", required_argument, NULL, 'j' },
+  { "size",      required_argument, NULL, 'W' },
+  { "scale",     required_argument, NULL, 'f' },
+  { "io",        required_argument, NULL, 'I' },
+  { "y16-lut",   no_argument,       NULL, 'L' },
   { "spi-mhz",   required_argument, NULL, 's' },
+  { "spi-auto",  required_argument, NULL, 'A' },
+  { "spi-state", required_argument, NULL, 'P' },
+  { "no-crc",    no_argument,       NULL, 'k' },
+  { "batch",     required_argument, NULL, 'b' },
+  { "rt-prio",   required_argument, NULL, 'r' },
+  { "cpu",       required_argument, NULL, 'a' },
+  { "record",    required_argument, NULL, 'R' },
+  { "frames",    required_argument, NULL, 'n' },
   { "verbose",   no_argument,       NULL, 'V' },
   { 0, 0, 0, 0 }
 };
 
-static void open_vpipe() {
-  if (typeLepton == 3) { width = 160; height = 120; }
-  else { width = 80; height = 60; }
-
-  v4l2sink = open(v4l2dev, O_WRONLY);
-  if (v4l2sink < 0) {
-    fprintf(stderr, "Failed to open v4l2sink device. (%s)\n", strerror(errno));
-    exit(2);
+// Render path, scaler and render context of an output. Returns false (after printing why)
+// for settings that do not go together.
+static bool setup_output(Output *o) {
+  const OutputConfig &c = o->cfg;
+  o->path = render_path_select(typeLepton, c.fmt, agcCfg.mode);
+  if (!o->path) {
+    fprintf(stderr, "no render path for Lepton %d with this output\n", typeLepton);
+    return false;
   }
+  if (verbose) fprintf(stderr, "%s: render path %s\n", c.dev, o->path->name);
 
-  struct v4l2_format v;
-  memset(&v, 0, sizeof(v));
-  v.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-
-  if (ioctl(v4l2sink, VIDIOC_G_FMT, &v) < 0) {
-    perror("VIDIOC_G_FMT");
-    exit(3);
-  }
-
-  v.fmt.pix.width = width;
-  v.fmt.pix.height = height;
-
-  if (outFmt == OUT_Y16) {
-    v.fmt.pix.pixelformat = V4L2_PIX_FMT_Y16;
-    vidsendsiz = width * height * 2;
-  } else {
-    v.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
-    vidsendsiz = width * height * 3;
-  }
-  v.fmt.pix.sizeimage = vidsendsiz;
-
-  if (ioctl(v4l2sink, VIDIOC_S_FMT, &v) < 0) {
-    perror("VIDIOC_S_FMT");
-    exit(4);
+  o->scaling = c.width && (c.width != o->path->width || c.height != o->path->height);
+  if (o->scaling) {
+    if (c.fmt == OUT_Y16) {
+      fprintf(stderr, "%s: --size does not apply to y16 output, raw counts are not resampled\n", c.dev);
+      return false;
+    }
+    // 4:2:2 shares chroma between pixel pairs, 4:2:0 over 2x2 blocks.
+    if ((c.fmt == OUT_YUYV && c.width % 2) || (c.fmt >= OUT_NV12 && (c.width % 2 || c.height % 2))) {
+      fprintf(stderr, "%s: --size must be even for %s output\n", c.dev, (c.fmt == OUT_YUYV) ? "yuyv" : "4:2:0");
+      return false;
+    }
+    if (!o->scaler.configure(o->path->width, o->path->height, c.width, c.height, c.filter, kernels)) return false;
+    if (verbose) fprintf(stderr, "%s: scale %dx%d -> %dx%d %s\n", c.dev, o->path->width, o->path->height,
+                         c.width, c.height, scale_filter_name(c.filter));
   }
 
-  vidsendbuf = (char*)malloc(vidsendsiz);
-  if (!vidsendbuf) {
-    fprintf(stderr, "malloc vidsendbuf failed\n");
-    exit(5);
+  // Outputs render one after the other on the render thread, so they share the stage.
+  static uint8_t stage[MAX_WIDTH * MAX_HEIGHT * 3];
+  RenderContext *ctx = &o->ctx;
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->kernels = kernels;
+  ctx->palette = (c.fmt == OUT_RGB24) ? palette_rgbx(c.colormap) : palette_yuvx(c.colormap, c.fmt == OUT_GREY);
+  ctx->stage = stage;
+  ctx->scaler = o->scaling ? &o->scaler : NULL;
+  const bool needScaled = o->scaling && c.fmt != OUT_RGB24;
+  const bool needLut = c.fmt != OUT_Y16 && (useY16Lut || agcCfg.mode == AGC_HEQ);
+  if (needScaled) ctx->scaled = (uint8_t *)malloc(c.width * c.height * 3);
+  if (needLut) ctx->y16Lut = (Y16RgbLut *)calloc(1, sizeof(Y16RgbLut));   // one per palette
+  if ((needScaled && !ctx->scaled) || (needLut && !ctx->y16Lut)) {
+    fprintf(stderr, "malloc render buffers failed\n");
+    return false;
   }
-  memset(vidsendbuf, 0, vidsendsiz);
+  return true;
 }
 
-extern int spi_cs_fd;
-
-static void maybe_override_spi_speed() {
-  if (spi_mhz <= 0) return;
-  unsigned int hz = (unsigned int)spi_mhz * 1000U * 1000U;
-  if (ioctl(spi_cs_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
-    perror("SPI_IOC_WR_MAX_SPEED_HZ");
-  }
-  if (verbose) {
-    unsigned int readback = 0;
-    if (ioctl(spi_cs_fd, SPI_IOC_RD_MAX_SPEED_HZ, &readback) == 0) {
-      fprintf(stderr, "SPI speed set/readback: %u Hz\n", readback);
+static void open_output(Output *o) {
+  const int width = o->scaling ? o->scaler.width() : o->path->width;
+  const int height = o->scaling ? o->scaler.height() : o->path->height;
+  const OutFmt fmt = o->cfg.fmt;
+
+  o->published = 0;
+  o->replaced = 0;
+  o->dropped = 0;
+  o->written = 0;
+
+  if (strncmp(o->cfg.dev, "shm:", 4) == 0) {
+    o->fd = -1;
+    o->size = out_fmt_frame_bytes(fmt, width, height);
+    if (!o->ring.create(o->cfg.dev + 4, SHM_RING_DEFAULT_SLOTS, o->size, width, height,
+                        out_fmt_fourcc(fmt), out_fmt_bytes_per_line(fmt, width))) {
+      exit(2);
     }
+    // Readers come and go without telling anyone; keep the ring fed.
+    o->sink = consumers.add_fixed(1);
+    o->shm = true;
+    if (o->cfg.mmapIo) fprintf(stderr, "%s: --io does not apply to a shared-memory ring\n", o->cfg.dev);
+    return;
   }
-}
 
-static void init_device() {
-  SpiOpenPort(spidev);
-  maybe_override_spi_speed();
-}
+  // Only an explicit file:<path> is created; a mistyped /dev/videoN must fail, not turn
+  // into a file in /dev.
+  if (strncmp(o->cfg.dev, "file:", 5) == 0) o->fd = open(o->cfg.dev + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  else o->fd = open(o->cfg.dev, O_WRONLY);
+  if (o->fd < 0) {
+    fprintf(stderr, "Failed to open v4l2sink device %s. (%s)\n", o->cfg.dev, strerror(errno));
+    exit(2);
+  }
 
-static void stop_device() { SpiClosePort(); }
+  o->size = out_fmt_frame_bytes(fmt, width, height);
 
-// discard packet pattern (xFxx)
-static inline bool is_discard_packet(const uint8_t *pkt) {
-  return ((pkt[0] & 0x0F) == 0x0F);
-}
+  struct v4l2_format v;
+  memset(&v, 0, sizeof(v));
+  v.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
 
-// Read 60 packets into `result`, keeping alignment.
-// Key behaviors:
-// - Lepton3 segment number is extracted at packetNumber==20 (same as reference LeptonThread.cpp logic).
-// - After 60 packets, peek 1 packet to handle telemetry (61st packet) vs next segment packet0 (stash).
-static bool read_block(int *out_segmentNumber, int *out_resets) {
-  int resets = 0;
-  int segmentNumber = -1;
-
-  for (int j = 0; j < PACKETS_PER_FRAME; j++) {
-    uint8_t *pkt = result + PACKET_SIZE * j;
-
-    if (j == 0 && stash_valid) {
-      memcpy(pkt, stash_pkt, PACKET_SIZE);
-      stash_valid = false;
-    } else {
-      if (read(spi_cs_fd, pkt, PACKET_SIZE) != PACKET_SIZE) {
-        j = -1;
-        resets++;
-        usleep(1000);
-        continue;
-      }
+  if (ioctl(o->fd, VIDIOC_G_FMT, &v) < 0) {
+    if (errno != ENOTTY) {
+      perror("VIDIOC_G_FMT");
+      exit(3);
     }
-
-    if (is_discard_packet(pkt)) {
-      j = -1;
-      resets++;
-      usleep(1000);
-      continue;
+    // Not a V4L2 node (/dev/null, file:<path>): just write raw frames, e.g. for benchmarking.
+    fprintf(stderr, "%s is not a V4L2 device, writing raw frames\n", o->cfg.dev);
+    o->sink = consumers.add_fixed(1);
+    o->lossless = true;
+    if (o->cfg.mmapIo) fprintf(stderr, "%s: --io mmap needs a V4L2 device, using write()\n", o->cfg.dev);
+  } else {
+    v.fmt.pix.width = width;
+    v.fmt.pix.height = height;
+    v.fmt.pix.pixelformat = out_fmt_fourcc(fmt);
+    v.fmt.pix.bytesperline = out_fmt_bytes_per_line(fmt, width);
+    v.fmt.pix.sizeimage = o->size;
+    v.fmt.pix.field = V4L2_FIELD_NONE;
+    if (fmt >= OUT_GREY) {
+      v.fmt.pix.colorspace = V4L2_COLORSPACE_SMPTE170M;
+      v.fmt.pix.ycbcr_enc = V4L2_YCBCR_ENC_601;
+      v.fmt.pix.quantization = (fmt == OUT_GREY) ? V4L2_QUANTIZATION_FULL_RANGE : V4L2_QUANTIZATION_LIM_RANGE;
     }
 
-    int packetNumber = pkt[1];
-    if (packetNumber != j) {
-      j = -1;
-      resets++;
-      usleep(1000);
-
-      if (resets == 750) {
-        SpiClosePort();
-        usleep(750000);
-        SpiOpenPort(spidev);
-        maybe_override_spi_speed();
-      }
-      continue;
+    if (ioctl(o->fd, VIDIOC_S_FMT, &v) < 0) {
+      perror("VIDIOC_S_FMT");
+      exit(4);
     }
 
-    if ((typeLepton == 3) && (packetNumber == 20)) {
-      int seg = (pkt[0] >> 4) & 0x0F;
-      // seg can be 0 for invalid segments; accept it and let upper layer drop
-      segmentNumber = seg;
+    o->sink = consumers.watch_v4l2(o->fd);
+    if (o->sink < 0) {
+      fprintf(stderr, "%s does not report its readers, capturing continuously\n", o->cfg.dev);
+      o->sink = consumers.add_fixed(1);
     }
-  }
 
-  // Peek 1 packet to keep alignment with telemetry on/off.
-  if (typeLepton == 3) {
-    uint8_t peek[PACKET_SIZE];
-    int r = read(spi_cs_fd, peek, PACKET_SIZE);
-    if (r == PACKET_SIZE && !is_discard_packet(peek)) {
-      int pn = peek[1];
-      if (pn != 60) {
-        memcpy(stash_pkt, peek, PACKET_SIZE);
-        stash_valid = true;
-      }
-      // pn==60 => telemetry packet; discard it
+    if (o->cfg.mmapIo) {
+      o->streaming = o->stream.start(o->fd, o->size, 4);
+      if (!o->streaming) fprintf(stderr, "%s: no streaming I/O, using write()\n", o->cfg.dev);
+      else if (verbose) fprintf(stderr, "%s: streaming, %d mapped buffers\n", o->cfg.dev, o->stream.buffers());
     }
   }
+  if (o->streaming) return;
 
-  if (verbose && resets >= 30) {
-    fprintf(stderr, "done reading, resets=%d\n", resets);
-  }
-
-  if (typeLepton == 3) {
-    if (segmentNumber == -1) segmentNumber = 0;
-    *out_segmentNumber = segmentNumber;
-  } else {
-    *out_segmentNumber = 1;
-  }
-
-  *out_resets = resets;
-  return true;
-}
-
-static void render_frame_lepton3() {
-  const int *cm = pick_colormap(typeColormap);
-  const int cmSize = COLORMAP_SIZE;
-
-  bool found = false;
-  uint16_t minV = 65535, maxV = 0;
-
-  for (int seg = 0; seg < 4; seg++) {
-    for (int i = 0; i < FRAME_SIZE_UINT16; i++) {
-      if (i % PACKET_SIZE_UINT16 < 2) continue;
-      uint16_t v = (shelf[seg][i*2] << 8) + shelf[seg][i*2+1];
-      if (v == 0) continue;
-      found = true;
-      if (v < minV) minV = v;
-      if (v > maxV) maxV = v;
+  for (int i = 0; i < 3; i++) {
+    o->buf[i] = (char*)malloc(o->size);
+    if (!o->buf[i]) {
+      fprintf(stderr, "malloc output buffer failed\n");
+      exit(5);
     }
+    memset(o->buf[i], 0, o->size);
+    o->seq[i] = 0;
   }
+}
 
-  if (!found) {
-    memset(vidsendbuf, 0, vidsendsiz);
-    if (verbose) fprintf(stderr, "L3: no valid pixels (all zeros). Output black frame.\n");
-    return;
-  }
-
-  float diff = (float)maxV - (float)minV;
-  float scale = (diff > 0.0f) ? (255.0f / diff) : 0.0f;
-
-  memset(vidsendbuf, 0, vidsendsiz);
-
-  for (int seg = 0; seg < 4; seg++) {
-    int ofsRow = 30 * seg;
-    for (int i = 0; i < FRAME_SIZE_UINT16; i++) {
-      if (i % PACKET_SIZE_UINT16 < 2) continue;
-
-      uint16_t vfb = (shelf[seg][i*2] << 8) + shelf[seg][i*2+1];
-      if (vfb == 0) continue;
-
-      int column = (i % PACKET_SIZE_UINT16) - 2
-                 + (width / 2) * ((i % (PACKET_SIZE_UINT16 * 2)) / PACKET_SIZE_UINT16);
-      int row = (i / PACKET_SIZE_UINT16) / 2 + ofsRow;
-
-      if (column < 0 || column >= width || row < 0 || row >= height) continue;
-
-      if (outFmt == OUT_Y16) {
-        uint16_t *out = (uint16_t*)vidsendbuf;
-        out[row * width + column] = vfb; // Y16 is little-endian in memory :contentReference[oaicite:4]{index=4}
-      } else {
-        int value8 = (diff > 0.0f) ? (int)((vfb - minV) * scale) : 0;
-        if (value8 < 0) value8 = 0;
-        if (value8 > 255) value8 = 255;
-
-        int ofs_r = 3 * value8 + 0; if (ofs_r >= cmSize) ofs_r = cmSize - 1;
-        int ofs_g = 3 * value8 + 1; if (ofs_g >= cmSize) ofs_g = cmSize - 1;
-        int ofs_b = 3 * value8 + 2; if (ofs_b >= cmSize) ofs_b = cmSize - 1;
-
-        int idx = (row * width + column) * 3;
-        vidsendbuf[idx + 0] = (char)cm[ofs_r];
-        vidsendbuf[idx + 1] = (char)cm[ofs_g];
-        vidsendbuf[idx + 2] = (char)cm[ofs_b];
+// Analyse the frame once, then render it into the back buffer of every output somebody
+// reads and hand it to that output's writer.
+static void render_frame(const Frame *f) {
+  RenderStats st;
+  st.valid = false;
+  if (nMapped) renderPath->analyse(f->pix, &f->stats, &agc, &clahe, &st);
+
+  for (int i = 0; i < nOutputs; i++) {
+    Output *o = &outputs[i];
+    if (consumers.count(o->sink) <= 0) continue;
+    if (o->streaming) {
+      // Frames are stamped with the time their first segment was read.
+      o->ctx.out = o->stream.acquire();
+      if (!o->ctx.out) {
+        o->dropped++;
+        continue;
       }
+      o->path->render(f->pix, &st, &o->ctx);
+      if (o->stream.queue(f->seg_ts_ns[0], (uint32_t)f->seq)) o->published++;
+      else o->dropped++;
+      continue;
+    }
+    if (o->shm) {
+      uint16_t lo = 0, hi = 0;
+      frame_stats_range(&f->stats, (typeLepton == 3) ? 4 : 1, &lo, &hi);
+      o->ctx.out = o->ring.begin();
+      o->path->render(f->pix, &st, &o->ctx);
+      o->ring.publish(f->seg_ts_ns[0], f->seq, f->tele.valid ? f->tele.frame_counter : 0, lo, hi);
+      o->published++;
+      continue;
+    }
+    if (o->lossless) {
+      while (o->xchg.pending()) sem_wait(&o->taken);
     }
+    const int b = o->xchg.back_index();
+    o->ctx.out = (uint8_t *)o->buf[b];
+    o->path->render(f->pix, &st, &o->ctx);
+    o->seq[b] = ++o->published;
+    if (!o->xchg.publish()) o->replaced++;
+    sem_post(&o->ready);
+    if (verbose && o->scaling) fprintf(stderr, "%s: scale %.0f us\n", o->cfg.dev, o->scaler.last_ns() * 1e-3);
   }
 
-  if (verbose) fprintf(stderr, "L3 %s min=%u max=%u\n", (outFmt==OUT_RGB24)?"RGB":"Y16", minV, maxV);
-}
-
-static void render_lepton2() {
-  const int *cm = pick_colormap(typeColormap);
-  const int cmSize = COLORMAP_SIZE;
-
-  bool found = false;
-  uint16_t minV = 65535, maxV = 0;
-
-  for (int i = 0; i < FRAME_SIZE_UINT16; i++) {
-    if (i % PACKET_SIZE_UINT16 < 2) continue;
-    uint16_t v = (shelf[0][i*2] << 8) + shelf[0][i*2+1];
-    if (v == 0) continue;
-    found = true;
-    if (v < minV) minV = v;
-    if (v > maxV) maxV = v;
+  if (verbose && st.valid && typeLepton == 3) fprintf(stderr, "%s min=%u max=%u\n", renderPath->name, st.minV, st.maxV);
+  if (verbose && !st.valid && nMapped) {
+    fprintf(stderr, "L%d: no valid pixels (all zeros). Output black frame.\n", typeLepton);
   }
-
-  if (!found) {
-    memset(vidsendbuf, 0, vidsendsiz);
-    return;
+  if (verbose && st.valid && agcCfg.mode == AGC_CLAHE) fprintf(stderr, "clahe: %.0f us\n", clahe.last_ns() * 1e-3);
+  if (verbose && f->tele.valid) {
+    fprintf(stderr, "frame #%u t=%ums fpa=%.2fC ffc=%d\n", f->tele.frame_counter, f->tele.time_ms,
+            f->tele.fpa_temp_k100 / 100.0 - 273.15, telemetry_ffc_state(&f->tele));
   }
+}
 
-  float diff = (float)maxV - (float)minV;
-  float scale = (diff > 0.0f) ? (255.0f / diff) : 0.0f;
-
-  memset(vidsendbuf, 0, vidsendsiz);
-
-  for (int i = 0; i < FRAME_SIZE_UINT16; i++) {
-    if (i % PACKET_SIZE_UINT16 < 2) continue;
-
-    uint16_t vfb = (shelf[0][i*2] << 8) + shelf[0][i*2+1];
-
-    int column = (i % PACKET_SIZE_UINT16) - 2;
-    int row = i / PACKET_SIZE_UINT16;
-    if (column < 0 || column >= width || row < 0 || row >= height) continue;
-
-    if (outFmt == OUT_Y16) {
-      uint16_t *out = (uint16_t*)vidsendbuf;
-      out[row * width + column] = vfb;
-    } else {
-      int value8 = (diff > 0.0f) ? (int)((vfb - minV) * scale) : 0;
-      if (value8 < 0) value8 = 0;
-      if (value8 > 255) value8 = 255;
+// Block until the capture thread has published a complete frame, render it and hand the slot back.
+// Returns false at the end of a finite source, once every published frame has been rendered,
+// or as soon as the last consumer has gone.
+static bool grab_frame() {
+  Frame *f = capture.next();
+  if (consumers.count() <= 0) return false;
+  if (!f) return false;
+  render_frame(f);
+  capture.release();
+  return true;
+}
 
-      int ofs_r = 3 * value8 + 0; if (ofs_r >= cmSize) ofs_r = cmSize - 1;
-      int ofs_g = 3 * value8 + 1; if (ofs_g >= cmSize) ofs_g = cmSize - 1;
-      int ofs_b = 3 * value8 + 2; if (ofs_b >= cmSize) ofs_b = cmSize - 1;
+// Watcher thread: the last consumer detached, get the render loop out of grab_frame().
+static void consumers_changed(int count) {
+  if (verbose) fprintf(stderr, "[INFO] consumers: %d\n", count);
+  if (count <= 0) capture.wake();
+}
 
-      int idx = (row * width + column) * 3;
-      vidsendbuf[idx + 0] = (char)cm[ofs_r];
-      vidsendbuf[idx + 1] = (char)cm[ofs_g];
-      vidsendbuf[idx + 2] = (char)cm[ofs_b];
-    }
+static void *sendvid(void *v) {
+  Output *o = (Output *)v;
+  for (;;) {
+    while (sem_wait(&o->ready) == -1 && errno == EINTR) {}
+    int b = o->xchg.take();
+    if (b < 0) continue;   // taken already, on an earlier wakeup
+    sem_post(&o->taken);
+    if (o->size != write(o->fd, o->buf[b], o->size)) exit(1);
+    pthread_mutex_lock(&o->sentLock);
+    o->written.store(o->seq[b], std::memory_order_release);
+    pthread_cond_broadcast(&o->sent);
+    pthread_mutex_unlock(&o->sentLock);
   }
 }
 
-static void grab_frame() {
-  if (typeLepton == 2) {
-    int segno = 1, resets = 0;
-    (void)read_block(&segno, &resets);
-    memcpy(shelf[0], result, sizeof(result));
-    render_lepton2();
-    return;
+// Wait for every output's writer to send the last frame published to it. A sink nobody
+// reads is skipped, and a writer stuck in write() is given up on after FLUSH_TIMEOUT_MS.
+#define FLUSH_TIMEOUT_MS 2000
+static void flush_outputs() {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += FLUSH_TIMEOUT_MS / 1000;
+  deadline.tv_nsec += (FLUSH_TIMEOUT_MS % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
   }
-
-  static bool got[4] = {false,false,false,false};
-  static unsigned invalidSegs = 0;
-
-  for (;;) {
-    int segno = 0, resets = 0;
-    (void)read_block(&segno, &resets);
-
-    // segno==0 => invalid segment; drop quietly (it happens)
-    if (segno < 1 || segno > 4) {
-      invalidSegs++;
-      if (verbose && (invalidSegs % 200 == 0)) {
-        fprintf(stderr, "[INFO] invalid segments seen: %u (segno=%d)\n", invalidSegs, segno);
+  for (int i = 0; i < nOutputs; i++) {
+    Output *o = &outputs[i];
+    if (o->streaming || o->shm) continue;   // handed over already
+    if (consumers.count(o->sink) <= 0) continue;
+    pthread_mutex_lock(&o->sentLock);
+    while (o->written.load(std::memory_order_acquire) != o->published) {
+      if (pthread_cond_timedwait(&o->sent, &o->sentLock, &deadline) == ETIMEDOUT) {
+        fprintf(stderr, "%s: writer stuck, %lu frames not sent\n", o->cfg.dev, o->published - o->written.load());
+        break;
       }
-      continue;
-    }
-
-    if (segno == 1) {
-      got[0]=got[1]=got[2]=got[3]=false;
-    }
-
-    memcpy(shelf[segno - 1], result, sizeof(result));
-    got[segno - 1] = true;
-
-    if (segno == 4 && got[0] && got[1] && got[2] && got[3]) {
-      invalidSegs = 0;
-      render_frame_lepton3();
-      return;
     }
-  }
-}
-
-static void *sendvid(void *v) {
-  (void)v;
-  for (;;) {
-    sem_wait(&lock1);
-    if (vidsendsiz != write(v4l2sink, vidsendbuf, vidsendsiz)) exit(1);
-    sem_post(&lock2);
+    pthread_mutex_unlock(&o->sentLock);
   }
 }
 
 int main(int argc, char **argv) {
+  OutputConfig *cur = &outDefaults;   // where -o, -c, -W, -f and -I go
   for (;;) {
     int index = 0;
     int c = getopt_long(argc, argv, short_options, long_options, &index);
@@ -423,47 +467,299 @@ int main(int argc, char **argv) {
 
     switch (c) {
       case 'd': spidev = optarg; break;
-      case 'v': v4l2dev = optarg; break;
+      case 'S': sourceSpec = optarg; break;
+      case 'v':
+        if (nOutputs == MAX_OUTPUTS) {
+          fprintf(stderr, "at most %d --video outputs\n", MAX_OUTPUTS);
+          return 1;
+        }
+        outputs[nOutputs].cfg = outDefaults;
+        outputs[nOutputs].cfg.dev = optarg;
+        cur = &outputs[nOutputs++].cfg;
+        break;
       case 't': typeLepton = (atoi(optarg) == 3) ? 3 : 2; break;
-      case 'o': outFmt = (strcmp(optarg, "y16") == 0) ? OUT_Y16 : OUT_RGB24; break;
+      case 'o':
+        if (!out_fmt_parse(optarg, &cur->fmt)) {
+          fprintf(stderr, "--out expects rgb, y16, grey, yuyv, nv12 or i420\n");
+          return 1;
+        }
+        break;
+      case 'T':
+        if (strcmp(optarg, "header") == 0) telemetryMode = TELEMETRY_HEADER;
+        else if (strcmp(optarg, "footer") == 0) telemetryMode = TELEMETRY_FOOTER;
+        else if (strcmp(optarg, "off") == 0) telemetryMode = TELEMETRY_OFF;
+        else {
+          fprintf(stderr, "--telemetry expects off, header or footer\n");
+          return 1;
+        }
+        break;
       case 'c': {
         int v = atoi(optarg);
-        if (v==1 || v==2 || v==3) typeColormap = v;
+        if (v==1 || v==2 || v==3) cur->colormap = v;
+      } break;
+      case 'm': simdName = optarg; break;
+      case 'g':
+        if (!agc_mode_parse(optarg, &agcCfg.mode)) {
+          fprintf(stderr, "--agc expects linear, clip, heq or clahe\n");
+          return 1;
+        }
+        break;
+      case 'C': {
+        double lo = 0, hi = -1;
+        int n = sscanf(optarg, "%lf:%lf", &lo, &hi);
+        if (n < 2) hi = lo;
+        if (n < 1 || lo < 0 || hi < 0 || lo + hi >= 100) {
+          fprintf(stderr, "--agc-clip expects <low>[:<high>] in percent, e.g. 1:0.5\n");
+          return 1;
+        }
+        agcCfg.clipLow = (unsigned)(lo * 100 + 0.5);
+        agcCfg.clipHigh = (unsigned)(hi * 100 + 0.5);
+      } break;
+      case 'p': {
+        double pct = atof(optarg);
+        if (pct <= 0 || pct > 100) {
+          fprintf(stderr, "--agc-plateau expects a percentage in (0, 100]\n");
+          return 1;
+        }
+        agcCfg.plateau = (unsigned)(pct * 100 + 0.5);
+      } break;
+      case 'D': {
+        double keep = atof(optarg);
+        if (keep < 0 || keep >= 1) {
+          fprintf(stderr, "--agc-damp expects a fraction in [0, 1)\n");
+          return 1;
+        }
+        agcCfg.damping = (unsigned)(keep * 256 + 0.5);
+        if (agcCfg.damping > 255) agcCfg.damping = 255;
+      } break;
+      case 'X':
+        if (sscanf(optarg, "%dx%d", &claheCfg.tilesX, &claheCfg.tilesY) != 2 ||
+            claheCfg.tilesX < 1 || claheCfg.tilesY < 1) {
+          fprintf(stderr, "--clahe-tiles expects <X>x<Y>, e.g. 8x8\n");
+          return 1;
+        }
+        break;
+      case 'l': {
+        double clip = atof(optarg);
+        if (clip < 1) {
+          fprintf(stderr, "--clahe-clip expects a factor of at least 1\n");
+          return 1;
+        }
+        claheCfg.clip = (unsigned)(clip * 100 + 0.5);
       } break;
+      case 'j': claheCfg.threads = atoi(optarg); break;
+      case 'W':
+        if (sscanf(optarg, "%dx%d", &cur->width, &cur->height) != 2 || cur->width < 1 || cur->height < 1) {
+          fprintf(stderr, "--size expects <W>x<H>, e.g. 1280x720\n");
+          return 1;
+        }
+        break;
+      case 'f':
+        if (!scale_filter_parse(optarg, &cur->filter)) {
+          fprintf(stderr, "--scale expects nearest, bilinear or bicubic\n");
+          return 1;
+        }
+        break;
+      case 'I':
+        if (strcmp(optarg, "write") && strcmp(optarg, "mmap")) {
+          fprintf(stderr, "--io expects write or mmap\n");
+          return 1;
+        }
+        cur->mmapIo = (strcmp(optarg, "mmap") == 0);
+        break;
+      case 'L': useY16Lut = true; break;
       case 's': spi_mhz = atoi(optarg); if (spi_mhz < 1) spi_mhz = 0; break;
+      case 'A': {
+        double lo = 0, hi = 0, errs = 1.0;
+        if (sscanf(optarg, "%lf:%lf:%lf", &lo, &hi, &errs) < 2 || lo <= 0 || hi < lo || errs < 0) {
+          fprintf(stderr, "--spi-auto expects <min>:<max>[:<err/s>] in MHz, e.g. 8:20\n");
+          return 1;
+        }
+        spiAuto = true;
+        spiTuneCfg.min_hz = (unsigned)(lo * 1e6);
+        spiTuneCfg.max_hz = (unsigned)(hi * 1e6);
+        spiTuneCfg.max_error_rate = errs;
+      } break;
+      case 'P': spiStatePath = optarg; break;
+      case 'k': checkCrc = false; break;
+      case 'b': spi_batch = atoi(optarg); if (spi_batch < 1) spi_batch = 1; break;
+      case 'r': rt_prio = atoi(optarg); if (rt_prio < 0) rt_prio = 0; break;
+      case 'a': capture_cpu = atoi(optarg); break;
+      case 'R': recordPath = optarg; break;
+      case 'n': maxFrames = strtoul(optarg, NULL, 10); break;
       case 'V': verbose = 1; break;
       case 'h':
       default: usage(argv[0]); return 0;
     }
   }
 
-  open_vpipe();
+  kernels = render_kernels_select(simdName);
+  if (!kernels) {
+    fprintf(stderr, "--simd %s is not available here (auto, %s)\n", simdName, render_kernels_available());
+    return 1;
+  }
+  if (verbose) fprintf(stderr, "render kernels: %s\n", kernels->name);
 
-  if (sem_init(&lock2, 0, 1) == -1) exit(1);
-  if (sem_init(&lock1, 0, 0) == -1) exit(1);
-  pthread_create(&sender, NULL, sendvid, NULL);
+  if (nOutputs == 0) {
+    outputs[0].cfg = outDefaults;
+    outputs[0].cfg.dev = v4l2dev;
+    nOutputs = 1;
+  }
+  for (int i = 0; i < nOutputs; i++) {
+    if (!setup_output(&outputs[i])) return 1;
+    if (outputs[i].cfg.fmt != OUT_Y16) nMapped++;
+  }
+  renderPath = outputs[0].path;
+  if (agcCfg.mode == AGC_CLAHE && nMapped) {
+    if (!clahe.configure(claheCfg, renderPath->width, renderPath->height)) return 1;
+    if (verbose) fprintf(stderr, "clahe: %dx%d tiles, %d threads\n", clahe.tiles_x(), clahe.tiles_y(), clahe.threads());
+  }
 
-  struct timespec ts;
+  static char defaultStatePath[256];
+  if (spiAuto) {
+    if (!spiStatePath) {
+      const char *dev = spidev ? spidev : spidev_default;
+      const char *base = strrchr(dev, '/');
+      snprintf(defaultStatePath, sizeof(defaultStatePath), "/var/tmp/v4l2lepton-%s.spi", base ? base + 1 : dev);
+      spiStatePath = defaultStatePath;
+    }
+    spiTuneCfg.step_hz = 1000000;
+    spiTuneCfg.window_sec = 2.0;
+    spiTuneCfg.state_path = spiStatePath;
+    spiTuneCfg.verbose = verbose;
+  }
 
-  for (;;) {
-    fprintf(stderr, "Waiting for sink\n");
-    sem_wait(&lock2);
+  CaptureConfig cfg;
+  cfg.typeLepton = typeLepton;
+  cfg.spidev = spidev;
+  cfg.spi_mhz = spi_mhz;
+  cfg.batch = spi_batch;
+  cfg.verbose = verbose;
+  source = capture_create(sourceSpec, &cfg);
+  if (!source) return 1;
+
+  consumers.on_change(consumers_changed);
+  for (int i = 0; i < nOutputs; i++) open_output(&outputs[i]);
+  if (!consumers.start()) fprintf(stderr, "cannot follow the readers, capturing continuously\n");
+  agc.configure(agcCfg);
+
+  FrameCaptureConfig fc;
+  fc.typeLepton = typeLepton;
+  fc.telemetry = telemetryMode;
+  fc.checkCrc = checkCrc;
+  fc.keepHist = nMapped && (agcCfg.mode == AGC_CLIP || agcCfg.mode == AGC_HEQ);
+  fc.path = renderPath;
+  fc.kernels = kernels;
+  fc.rtPrio = rt_prio;
+  fc.cpu = capture_cpu;
+  fc.spiAuto = spiAuto;
+  fc.spiTune = &spiTuneCfg;
+  fc.spiHz = (unsigned)spi_mhz * 1000000U;
+  fc.recorder = recordPath ? &recorder : NULL;
+  fc.verbose = verbose;
+  capture.configure(source, fc);
+
+  if (recordPath && !recorder.open(recordPath, typeLepton, capture.segments(), capture.packets_per_segment())) {
+    return 1;
+  }
+
+  // Page faults under SCHED_FIFO defeat the point of the RT capture thread.
+  if (rt_prio > 0 && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    perror("mlockall");
+  }
+
+  for (int i = 0; i < nOutputs; i++) {
+    Output *o = &outputs[i];
+    if (o->streaming || o->shm) continue;
+    if (sem_init(&o->ready, 0, 0) == -1 || sem_init(&o->taken, 0, 0) == -1) exit(1);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&o->sent, &ca);
+    pthread_condattr_destroy(&ca);
+    pthread_mutex_init(&o->sentLock, NULL);
+    pthread_create(&o->writer, NULL, sendvid, o);
+  }
+
+  bool finished = false;
+  while (!finished) {
+    if (consumers.count() <= 0) {
+      fprintf(stderr, "Waiting for a consumer\n");
+      consumers.wait_present();
+    }
+
+    // The render thread is not consuming here, so the AGC history can be reset safely.
+    agc.reset();
+    if (!capture.start()) exit(1);
 
-    init_device();
+    struct timespec t0, t1;
+    unsigned long frames = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
     for (;;) {
-      grab_frame();
-      sem_post(&lock1);
+      if (!grab_frame()) break;
+      frames++;
 
-      clock_gettime(CLOCK_REALTIME, &ts);
-      ts.tv_sec += 2;
+      if (maxFrames && frames >= maxFrames) {
+        flush_outputs();     // let the last frames go out
+        finished = true;
+        break;
+      }
+    }
 
-      if (sem_timedwait(&lock2, &ts)) break;
+    capture.stop();
+    finished = finished || capture.eos();
+    if (!finished && verbose) fprintf(stderr, "[INFO] no consumers, capture paused\n");
+
+    if (finished) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+      fprintf(stderr, "%s capture finished: %lu frames in %.3f s (%.1f fps)\n",
+              source->name(), frames, secs, (secs > 0) ? frames / secs : 0.0);
+      if (capture.crc_errors() || capture.sync_losses() || capture.bad_segments()) {
+        fprintf(stderr, "link errors: %lu CRC, %lu sync losses, %lu bad segment numbers\n",
+                capture.crc_errors(), capture.sync_losses(), capture.bad_segments());
+      }
+      if (agcCfg.mode == AGC_CLAHE && nMapped) {
+        fprintf(stderr, "clahe: %.0f us avg, %.0f us max per frame (%dx%d tiles, %d threads)\n",
+                clahe.avg_ns() * 1e-3, clahe.max_ns() * 1e-3, clahe.tiles_x(), clahe.tiles_y(), clahe.threads());
+      }
+      for (int i = 0; i < nOutputs; i++) {
+        const Output *o = &outputs[i];
+        if (o->dropped) {
+          fprintf(stderr, "%s: %lu frames dropped, every driver buffer was still queued\n", o->cfg.dev, o->dropped);
+        }
+        if (o->shm) {
+          fprintf(stderr, "%s: %lu frames published, %d readers attached, %lu wakeups\n",
+                  o->cfg.dev, o->published, o->ring.readers(), o->ring.wakeups());
+        }
+        if (o->replaced) {
+          fprintf(stderr, "%s: %lu of %lu frames replaced by a newer one before the writer sent them\n",
+                  o->cfg.dev, o->replaced, o->published);
+        }
+        if (!o->scaling) continue;
+        fprintf(stderr, "%s: scale %.0f us avg per frame (%s, %dx%d), %lu repeated frames not rescaled\n",
+                o->cfg.dev, o->scaler.avg_ns() * 1e-3, scale_filter_name(o->cfg.filter),
+                o->scaler.width(), o->scaler.height(), (unsigned long)o->scaler.repeats());
+      }
+      const ResyncStats &rs = capture.resyncs();
+      if (rs.count) {
+        fprintf(stderr, "resyncs: %lu (%lu reopens), time to resync %.1f ms avg, %.1f ms max\n",
+                rs.count, rs.reopens, rs.total_ns * 1e-6 / rs.count, rs.max_ns * 1e-6);
+      }
     }
+  }
 
-    stop_device();
+  if (recordPath) {
+    recorder.close();
+    fprintf(stderr, "recorded %lu frames to %s (%lu dropped)\n", recorder.written(), recordPath, recorder.dropped());
   }
 
-  close(v4l2sink);
+  delete source;
+  for (int i = 0; i < nOutputs; i++) {
+    outputs[i].stream.stop();
+    outputs[i].ring.close();
+    if (outputs[i].fd >= 0) close(outputs[i].fd);
+  }
   return 0;
 }
\ No newline at end of file
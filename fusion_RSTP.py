@@ -1,7 +1,10 @@
 #!/usr/bin/env python3
+import os
+import sys
 import time
 import threading
 import argparse
+import collections
 import numpy as np
 import cv2
 
@@ -16,13 +19,17 @@ def ns():
     return time.monotonic_ns()
 
 class FusionState:
-    def __init__(self, alpha: float, delta_ms: float):
+    def __init__(self, alpha: float, delta_ms: float, align: str = "latest", hold_ms: float = 0.0):
         self.alpha = float(alpha)
         self.delta_ns = int(delta_ms * 1e6)
+        self.align = align                 # latest, nearest or interpolate
+        self.hold_ns = int(hold_ms * 1e6)
 
         self.lock = threading.Lock()
         self.last_th_frame = None          # np.ndarray BGR
         self.last_th_ts = None             # ns
+        self.th_cam = None                 # leptoncore.Camera with history, for nearest/interpolate
+        self.pending = collections.deque() # GS frames held for their thermal frame (GS thread only)
 
         self.appsrc = None                # set when RTSP media created
         self.out_w = None
@@ -34,10 +41,35 @@ class FusionState:
             self.last_th_frame = frame_bgr
             self.last_th_ts = ts_ns
 
+    def thermal_at(self, ts_ns: int):
+        # by capture time from the native history, else whichever thermal frame came last
+        cam = self.th_cam
+        if cam is not None and self.align != "latest":
+            f = cam.frame_at(ts_ns, interpolate=(self.align == "interpolate"))
+            if f is None:
+                return None, None
+            if cam.format == "y16":
+                return render_counts(f), f.timestamp_ns
+            return cv2.cvtColor(np.asarray(f), cv2.COLOR_RGB2BGR), f.timestamp_ns
+        with self.lock:
+            return self.last_th_frame, self.last_th_ts
+
     def fuse_and_push(self, gs_bgr: np.ndarray, gs_ts_ns: int):
+        # The thermal frame captured after a GS frame arrives up to a thermal frame period
+        # (~110 ms at 9 Hz) later; hold GS frames until it is in, at most hold_ns, so they
+        # can be matched from both sides instead of against the newest thermal frame.
+        self.pending.append((gs_bgr, gs_ts_ns))
+        while self.pending:
+            frame, ts = self.pending[0]
+            span = self.th_cam.history_span() if self.th_cam is not None and self.align != "latest" else None
+            if span is not None and span[1] < ts and ns() - ts < self.hold_ns:
+                break
+            self.pending.popleft()
+            self.fuse_one(frame, ts)
+
+    def fuse_one(self, gs_bgr: np.ndarray, gs_ts_ns: int):
+        th, th_ts = self.thermal_at(gs_ts_ns)
         with self.lock:
-            th = self.last_th_frame
-            th_ts = self.last_th_ts
             appsrc = self.appsrc
             out_w, out_h, out_fps = self.out_w, self.out_h, self.out_fps
 
@@ -51,7 +83,7 @@ class FusionState:
         if th is None:
             fused = gs_bgr
         else:
-            # hold last thermal if no new frame; use ±Δt only as "simultaneous" label (optional)
+            # thermal frame matched in time (or the last one); ±Δt only labels a poor match
             if th.shape[1] != out_w or th.shape[0] != out_h:
                 th2 = cv2.resize(th, (out_w, out_h), interpolation=cv2.INTER_LINEAR)
             else:
@@ -106,7 +138,7 @@ class FusionFactory(GstRtspServer.RTSPMediaFactory):
         self.state.out_h = self.height
         self.state.out_fps = self.fps
 
-def make_appsinks(gs_w, gs_h, gs_fps, th_dev):
+def make_appsinks(gs_w, gs_h, gs_fps, th_dev, th_w, th_h, th_capture_ts=False):
     # appsink: emit-signals must be true to get new-sample callbacks :contentReference[oaicite:7]{index=7}
     gs_pipe = Gst.parse_launch(
         f"libcamerasrc ! video/x-raw,width={gs_w},height={gs_h},framerate={gs_fps}/1,format=NV12 "
@@ -114,8 +146,8 @@ def make_appsinks(gs_w, gs_h, gs_fps, th_dev):
         f"! appsink name=gssink emit-signals=true max-buffers=1 drop=true sync=false"
     )
     th_pipe = Gst.parse_launch(
-        f"v4l2src device={th_dev} do-timestamp=true "
-        f"! video/x-raw,format=RGB,width=160,height=120 "
+        f"v4l2src device={th_dev} do-timestamp={'false' if th_capture_ts else 'true'} "
+        f"! video/x-raw,format=RGB,width={th_w},height={th_h} "
         f"! videoconvert ! video/x-raw,format=BGR "
         f"! appsink name=thsink emit-signals=true max-buffers=1 drop=true sync=false"
     )
@@ -137,6 +169,46 @@ def sample_to_bgr(sample):
     finally:
         buf.unmap(mapinfo)
 
+def render_counts(f):
+    # Raw counts (a leptoncore y16 frame, possibly blended) -> BGR: stretch the frame's own
+    # min..max to 8 bits and colour it. Interpolation has to happen on counts; blending two
+    # rendered frames mixes two AGC stretches.
+    lo, hi = int(f.min), int(f.max)
+    scale = 255.0 / max(hi - lo, 1)
+    grey = cv2.convertScaleAbs(np.asarray(f), alpha=scale, beta=-lo * scale)
+    return cv2.applyColorMap(grey, cv2.COLORMAP_INFERNO)
+
+def sample_ts(sample, pipe):
+    # Buffer PTS on the pipeline clock, which for the default system clock is
+    # CLOCK_MONOTONIC like the thermal capture times; arrival time if it does not fit.
+    now = ns()
+    pts = sample.get_buffer().pts
+    if pts == Gst.CLOCK_TIME_NONE:
+        return now
+    ts = pts + pipe.get_base_time()
+    return ts if abs(now - ts) < 1_000_000_000 else now
+
+def load_leptoncore():
+    # `make python` in the v4l2lepton directory builds the module next to its sources
+    sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                 "Thirdparty", "v4l2lepton_by_groupgets_modified"))
+    import leptoncore
+    return leptoncore
+
+def run_native_thermal(state, cam):
+    # Frames are pooled native buffers: np.asarray() maps one without a copy, and the
+    # RGB->BGR conversion is the only pass over it. The frame's buffer goes back to the
+    # pool once `rgb` is dropped.
+    with cam:
+        while True:
+            try:
+                f = cam.next_frame()
+            except EOFError:
+                return
+            rgb = np.asarray(f)
+            state.update_thermal(cv2.cvtColor(rgb, cv2.COLOR_RGB2BGR), f.timestamp_ns)
+            del rgb, f
+
 def main():
     ap = argparse.ArgumentParser()
     ap.add_argument("--port", type=int, default=8554)
@@ -145,12 +217,25 @@ def main():
     ap.add_argument("--gs-h", type=int, default=720)
     ap.add_argument("--gs-fps", type=int, default=30)
     ap.add_argument("--th-dev", type=str, default="/dev/video42")
+    # thermal size as v4l2lepton outputs it; run it with --size <gs-w>x<gs-h> to skip the resize here
+    ap.add_argument("--th-w", type=int, default=160)
+    ap.add_argument("--th-h", type=int, default=120)
+    # v4l2lepton --io mmap stamps each frame with its capture time; keep it instead of arrival time
+    ap.add_argument("--th-capture-ts", action="store_true")
+    # capture the Lepton in-process (leptoncore) instead of reading v4l2lepton's output device
+    ap.add_argument("--th-native", action="store_true")
+    ap.add_argument("--th-type", type=int, default=3)
+    ap.add_argument("--th-source", type=str, default=None, help="leptoncore source, e.g. synth:rt")
+    # --th-native only: pair each GS frame with the thermal frame captured nearest to it, or
+    # a blend of the two either side; hold GS frames up to --align-hold-ms for the later one
+    ap.add_argument("--th-align", choices=["latest", "nearest", "interpolate"], default="nearest")
+    ap.add_argument("--align-hold-ms", type=float, default=0.0)
     ap.add_argument("--alpha", type=float, default=0.35)
     ap.add_argument("--delta-ms", type=float, default=50.0)
     ap.add_argument("--bitrate-kbps", type=int, default=4000)
     args = ap.parse_args()
 
-    state = FusionState(args.alpha, args.delta_ms)
+    state = FusionState(args.alpha, args.delta_ms, args.th_align if args.th_native else "latest", args.align_hold_ms)
 
     # RTSP server
     server = GstRtspServer.RTSPServer()
@@ -163,10 +248,23 @@ def main():
     server.attach(None)
 
     # capture pipelines -> appsinks
-    gs_pipe, th_pipe = make_appsinks(args.gs_w, args.gs_h, args.gs_fps, args.th_dev)
+    gs_pipe, th_pipe = make_appsinks(args.gs_w, args.gs_h, args.gs_fps, args.th_dev, args.th_w, args.th_h, args.th_capture_ts)
     gssink = gs_pipe.get_by_name("gssink")
     thsink = th_pipe.get_by_name("thsink")
 
+    if args.th_native:
+        leptoncore = load_leptoncore()
+        if args.th_align == "latest":
+            cam = leptoncore.Camera(type=args.th_type, format="rgb", source=args.th_source)
+            threading.Thread(target=run_native_thermal, args=(state, cam), daemon=True).start()
+        else:
+            # ~1 s of thermal frames to match against; interpolation blends raw counts
+            fmt = "y16" if args.th_align == "interpolate" else "rgb"
+            cam = leptoncore.Camera(type=args.th_type, format=fmt, source=args.th_source, history=8)
+            cam.start()
+            state.th_cam = cam
+        th_pipe = None
+
     def on_th_sample(sink):
         sample = sink.emit("pull-sample")
         frame = sample_to_bgr(sample)
@@ -178,13 +276,15 @@ def main():
         sample = sink.emit("pull-sample")
         frame = sample_to_bgr(sample)
         if frame is not None:
-            state.fuse_and_push(frame, ns())
+            state.fuse_and_push(frame, sample_ts(sample, gs_pipe) if state.th_cam is not None else ns())
         return Gst.FlowReturn.OK
 
-    thsink.connect("new-sample", on_th_sample)
+    if th_pipe is not None:
+        thsink.connect("new-sample", on_th_sample)
     gssink.connect("new-sample", on_gs_sample)
 
-    th_pipe.set_state(Gst.State.PLAYING)
+    if th_pipe is not None:
+        th_pipe.set_state(Gst.State.PLAYING)
     gs_pipe.set_state(Gst.State.PLAYING)
 
     print(f"Fusion RTSP: rtsp://<PI_IP>:{args.port}{args.path}")